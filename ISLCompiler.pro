@@ -1,19 +1,42 @@
 TEMPLATE = app
 TARGET   = islcompiler
-CONFIG  += c++11 console utf8_source
+CONFIG  += c++11 console utf8_source thread
 CONFIG  -= qt
 CONFIG  -= debug_and_release debug_and_release_target
 
 HEADERS += \
+    $$PWD/src/crc32c.h \
+    $$PWD/src/islcoverage.h \
+    $$PWD/src/islformat.h \
     $$PWD/src/islparser.h \
+    $$PWD/src/islplural.h \
+    $$PWD/src/islmanifest.h \
+    $$PWD/src/threadpool.h \
+    $$PWD/src/utf16.h \
     $$PWD/src/utils.h \
     $$PWD/src/version.h
 
 SOURCES += \
     $$PWD/src/main.cpp \
+    $$PWD/src/batchio.cpp \
+    $$PWD/src/crc32c.cpp \
+    $$PWD/src/islcoverage.cpp \
+    $$PWD/src/islformat.cpp \
     $$PWD/src/islparser.cpp \
+    $$PWD/src/islplural.cpp \
+    $$PWD/src/islmanifest.cpp \
+    $$PWD/src/threadpool.cpp \
+    $$PWD/src/utf16.cpp \
     $$PWD/src/utils.cpp
 
+linux {
+    HEADERS += \
+        $$PWD/src/islserver.h
+
+    SOURCES += \
+        $$PWD/src/islserver.cpp
+}
+
 win32 {
     CONFIG -= embed_manifest_exe
     RC_FILE = $$PWD/res/version.rc
@@ -0,0 +1,39 @@
+TEMPLATE = lib
+TARGET   = islcompiler
+CONFIG  += c++11 shared utf8_source thread
+CONFIG  -= qt
+CONFIG  -= debug_and_release debug_and_release_target
+DEFINES += ISL_LIBRARY
+
+HEADERS += \
+    $$PWD/src/crc32c.h \
+    $$PWD/src/islapi.h \
+    $$PWD/src/islformat.h \
+    $$PWD/src/islparser.h \
+    $$PWD/src/islplural.h \
+    $$PWD/src/islreader.h \
+    $$PWD/src/threadpool.h \
+    $$PWD/src/utf16.h \
+    $$PWD/src/utils.h \
+    $$PWD/src/version.h
+
+SOURCES += \
+    $$PWD/src/islapi.cpp \
+    $$PWD/src/batchio.cpp \
+    $$PWD/src/crc32c.cpp \
+    $$PWD/src/islformat.cpp \
+    $$PWD/src/islparser.cpp \
+    $$PWD/src/islplural.cpp \
+    $$PWD/src/islreader.cpp \
+    $$PWD/src/threadpool.cpp \
+    $$PWD/src/utf16.cpp \
+    $$PWD/src/utils.cpp
+
+unix {
+    QMAKE_CXXFLAGS += -fvisibility=hidden -fvisibility-inlines-hidden
+}
+
+DESTDIR = $$PWD/build
+OBJECTS_DIR = $$DESTDIR/obj_lib
+MOC_DIR = $$DESTDIR/moc_lib
+RCC_DIR = $$DESTDIR/rcc_lib
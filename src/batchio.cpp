@@ -0,0 +1,311 @@
+#include "utils.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#ifdef __linux__
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#elif !defined(_WIN32)
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#define BATCH_SIZE 64
+
+
+#ifdef __linux__
+class IoUring
+{
+public:
+    explicit IoUring(unsigned entries) :
+        fd(-1), sqPtr(MAP_FAILED), cqPtr(MAP_FAILED), sqes((io_uring_sqe*)MAP_FAILED), failed(false)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0)
+            return;
+        sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sqSize = cqSize = std::max(sqSize, cqSize);
+        sqPtr = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqPtr == MAP_FAILED)
+            return;
+        cqPtr = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqPtr :
+                    mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqPtr == MAP_FAILED)
+            return;
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+        char *sq = (char*)sqPtr, *cq = (char*)cqPtr;
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        tail = *sqTail;
+        queued = 0;
+    }
+
+    ~IoUring()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+        if (cqPtr != MAP_FAILED && cqPtr != sqPtr)
+            munmap(cqPtr, cqSize);
+        if (sqPtr != MAP_FAILED)
+            munmap(sqPtr, sqSize);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool isValid() const
+    {
+        return fd >= 0 && sqPtr != MAP_FAILED && cqPtr != MAP_FAILED && sqes != MAP_FAILED && !failed;
+    }
+
+    io_uring_sqe* nextSqe(uint8_t opcode, int sqeFd, uint64_t userData)
+    {
+        io_uring_sqe *sqe = &sqes[tail & sqMask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = sqeFd;
+        sqe->user_data = userData;
+        sqArray[tail & sqMask] = tail & sqMask;
+        tail++;
+        queued++;
+        return sqe;
+    }
+
+    bool submitAndWait(unsigned minComplete)
+    {
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        for (;;) {
+            int ret = syscall(__NR_io_uring_enter, fd, queued, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (ret >= 0) {
+                queued -= ret;
+                return true;
+            }
+            if (errno != EINTR) {
+                failed = true;
+                return false;
+            }
+        }
+    }
+
+    bool popCqe(io_uring_cqe &cqe)
+    {
+        unsigned head = *cqHead;
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            return false;
+        cqe = cqes[head & cqMask];
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    int fd;
+    void *sqPtr, *cqPtr;
+    size_t sqSize, cqSize, sqesSize;
+    io_uring_sqe *sqes;
+    io_uring_cqe *cqes;
+    unsigned *sqTail, *sqArray, *cqHead, *cqTail;
+    unsigned sqMask, cqMask, tail, queued;
+    bool failed;
+};
+
+enum UringOp {
+    OP_OPEN = 0,
+    OP_STAT,
+    OP_READ,
+    OP_CLOSE
+};
+
+static uint64_t userData(size_t index, UringOp op)
+{
+    return ((uint64_t)index << 2) | op;
+}
+
+static void waitAll(IoUring &ring, unsigned count, const std::function<void(size_t, UringOp, int)> &handler)
+{
+    while (count != 0) {
+        if (!ring.submitAndWait(1))
+            return;
+        io_uring_cqe cqe;
+        while (count != 0 && ring.popCqe(cqe)) {
+            handler(cqe.user_data >> 2, (UringOp)(cqe.user_data & 3), cqe.res);
+            count--;
+        }
+    }
+}
+
+static void readBatchUring(IoUring &ring, const std::vector<tstring> &filePaths, size_t first, size_t last,
+                           std::vector<std::string> &contents, std::vector<char> &done)
+{
+    // Open and stat the whole batch with one submission, then read it with another
+    size_t count = last - first;
+    std::vector<int> fds(count, -1);
+    std::vector<struct statx> stats(count);
+    for (size_t i = 0; i < count; i++) {
+        io_uring_sqe *sqe = ring.nextSqe(IORING_OP_OPENAT, AT_FDCWD, userData(i, OP_OPEN));
+        sqe->addr = (uint64_t)filePaths[first + i].c_str();
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe = ring.nextSqe(IORING_OP_STATX, AT_FDCWD, userData(i, OP_STAT));
+        sqe->addr = (uint64_t)filePaths[first + i].c_str();
+        sqe->len = STATX_SIZE;
+        sqe->off = (uint64_t)&stats[i];
+    }
+    std::vector<char> statOk(count, 0);
+    waitAll(ring, count * 2, [&](size_t i, UringOp op, int res) {
+        if (op == OP_OPEN)
+            fds[i] = res;
+        else
+            statOk[i] = (res == 0);
+    });
+
+    std::vector<size_t> offsets(count, 0);
+    unsigned pending = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (fds[i] < 0 || !statOk[i])
+            continue;
+        contents[first + i].resize(stats[i].stx_size);
+        if (stats[i].stx_size == 0) {
+            done[first + i] = 1;
+            continue;
+        }
+        io_uring_sqe *sqe = ring.nextSqe(IORING_OP_READ, fds[i], userData(i, OP_READ));
+        sqe->addr = (uint64_t)&contents[first + i][0];
+        sqe->len = stats[i].stx_size;
+        pending++;
+    }
+    while (pending != 0) {
+        std::vector<size_t> retry;
+        waitAll(ring, pending, [&](size_t i, UringOp, int res) {
+            std::string &data = contents[first + i];
+            // Errors and files that shrank are left to the fallback path, which reports them
+            if (res <= 0)
+                return;
+            offsets[i] += res;
+            if (offsets[i] == data.size()) {
+                done[first + i] = 1;
+            } else {
+                retry.push_back(i);
+            }
+        });
+        pending = 0;
+        for (size_t i : retry) {
+            io_uring_sqe *sqe = ring.nextSqe(IORING_OP_READ, fds[i], userData(i, OP_READ));
+            sqe->addr = (uint64_t)&contents[first + i][offsets[i]];
+            sqe->len = contents[first + i].size() - offsets[i];
+            sqe->off = offsets[i];
+            pending++;
+        }
+    }
+
+    unsigned opened = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (fds[i] >= 0 && !ring.isValid()) {
+            close(fds[i]);
+            continue;
+        }
+        if (fds[i] >= 0) {
+            ring.nextSqe(IORING_OP_CLOSE, fds[i], userData(i, OP_CLOSE));
+            opened++;
+        }
+    }
+    waitAll(ring, opened, [&](size_t i, UringOp, int res) {
+        if (res == -EINVAL)
+            close(fds[i]);
+    });
+}
+#endif
+
+static bool readFileDirect(const tstring &filePath, std::string &str)
+{
+#ifdef _WIN32
+    return NS_File::readFile(filePath, str);
+#else
+    int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    str.resize(st.st_size);
+    size_t offset = 0;
+    while (offset < str.size()) {
+        ssize_t n = pread(fd, &str[offset], str.size() - offset, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        offset += n;
+    }
+    close(fd);
+    // A read error or a file that shrank while reading must not compile as truncated input
+    if (offset != str.size()) {
+        str.clear();
+        return false;
+    }
+    return true;
+#endif
+}
+
+namespace NS_File
+{
+    bool readFiles(const std::vector<tstring> &filePaths, std::vector<std::string> &contents, std::vector<bool> &loaded)
+    {
+        contents.assign(filePaths.size(), std::string());
+        std::vector<char> done(filePaths.size(), 0);
+#ifdef __linux__
+        IoUring ring(BATCH_SIZE * 2);
+        for (size_t first = 0; first < filePaths.size() && ring.isValid(); first += BATCH_SIZE)
+            readBatchUring(ring, filePaths, first, std::min(first + BATCH_SIZE, filePaths.size()), contents, done);
+#endif
+        // Whatever io_uring could not load (or all files, without it) is read on a thread pool
+        std::vector<size_t> rest;
+        for (size_t i = 0; i < filePaths.size(); i++) {
+            if (!done[i])
+                rest.push_back(i);
+        }
+        if (rest.size() == 1) {
+            done[rest[0]] = readFileDirect(filePaths[rest[0]], contents[rest[0]]);
+        } else
+        if (!rest.empty()) {
+            ThreadPool pool(std::min<size_t>(rest.size(), 16));
+            for (size_t i : rest) {
+                pool.submit([&, i]() {
+                    done[i] = readFileDirect(filePaths[i], contents[i]);
+                });
+            }
+            pool.wait();
+        }
+
+        bool success = true;
+        loaded.assign(filePaths.size(), false);
+        for (size_t i = 0; i < filePaths.size(); i++) {
+            loaded[i] = done[i] != 0;
+            if (!done[i]) {
+                NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
+                success = false;
+            }
+        }
+        return success;
+    }
+}
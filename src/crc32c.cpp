@@ -0,0 +1,158 @@
+#include "crc32c.h"
+#include <cstring>
+#if defined(__x86_64__) || defined(_M_X64)
+# include <nmmintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+# define CRC32C_X86
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+# include <arm_acle.h>
+# define CRC32C_ARM
+#endif
+
+#define CRC32C_POLY 0x82f63b78
+
+
+struct Crc32cTable
+{
+    Crc32cTable()
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++)
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++)
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+        }
+    }
+
+    uint32_t table[8][256];
+};
+
+static uint32_t crc32cSoftware(uint32_t crc, const char *data, size_t size)
+{
+    static const Crc32cTable t;
+    const unsigned char *p = (const unsigned char*)data;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        word ^= crc;
+        crc = t.table[7][word & 0xff] ^ t.table[6][(word >> 8) & 0xff] ^ t.table[5][(word >> 16) & 0xff]
+                ^ t.table[4][(word >> 24) & 0xff] ^ t.table[3][(word >> 32) & 0xff] ^ t.table[2][(word >> 40) & 0xff]
+                ^ t.table[1][(word >> 48) & 0xff] ^ t.table[0][word >> 56];
+        p += 8;
+        size -= 8;
+    }
+    while (size--)
+        crc = (crc >> 8) ^ t.table[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#ifdef CRC32C_X86
+# ifndef _MSC_VER
+__attribute__((target("sse4.2")))
+# endif
+static uint32_t crc32cHardware(uint32_t crc, const char *data, size_t size)
+{
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (size--)
+        crc = _mm_crc32_u8(crc, (unsigned char)*data++);
+    return crc;
+}
+
+static bool hasHardwareCrc()
+{
+# ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+# else
+    return __builtin_cpu_supports("sse4.2");
+# endif
+}
+#elif defined(CRC32C_ARM)
+static uint32_t crc32cHardware(uint32_t crc, const char *data, size_t size)
+{
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+        data += 8;
+        size -= 8;
+    }
+    while (size--)
+        crc = __crc32cb(crc, (unsigned char)*data++);
+    return crc;
+}
+
+static bool hasHardwareCrc()
+{
+    return true;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const char *data, size_t size)
+{
+#if defined(CRC32C_X86) || defined(CRC32C_ARM)
+    static const bool hardware = hasHardwareCrc();
+    if (hardware)
+        return ~crc32cHardware(~crc, data, size);
+#endif
+    return ~crc32cSoftware(~crc, data, size);
+}
+
+static uint32_t gf2MatrixTimes(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    for (; vec != 0; vec >>= 1, mat++) {
+        if (vec & 1)
+            sum ^= *mat;
+    }
+    return sum;
+}
+
+static void gf2MatrixSquare(uint32_t *square, const uint32_t *mat)
+{
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2MatrixTimes(mat, mat[n]);
+}
+
+uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, size_t size2)
+{
+    // CRC of A followed by B from crc(A), crc(B) and the length of B, as in zlib's crc32_combine
+    if (size2 == 0)
+        return crc1;
+    uint32_t even[32], odd[32];
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++)
+        odd[n] = 1u << (n - 1);
+    gf2MatrixSquare(even, odd);
+    gf2MatrixSquare(odd, even);
+    for (;;) {
+        gf2MatrixSquare(even, odd);
+        if (size2 & 1)
+            crc1 = gf2MatrixTimes(even, crc1);
+        size2 >>= 1;
+        if (size2 == 0)
+            break;
+        gf2MatrixSquare(odd, even);
+        if (size2 & 1)
+            crc1 = gf2MatrixTimes(odd, crc1);
+        size2 >>= 1;
+        if (size2 == 0)
+            break;
+    }
+    return crc1 ^ crc2;
+}
@@ -0,0 +1,10 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+uint32_t crc32c(uint32_t crc, const char *data, size_t size);
+uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, size_t size2);
+
+#endif // CRC32C_H
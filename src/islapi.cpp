@@ -0,0 +1,152 @@
+#include "islapi.h"
+#include "islparser.h"
+#include "utils.h"
+#include "version.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+
+static char* copyBuffer(const std::string &data)
+{
+    char *buf = (char*)malloc(data.size() + 1);
+    if (buf) {
+        memcpy(buf, data.data(), data.size());
+        buf[data.size()] = '\0';
+    }
+    return buf;
+}
+
+static int fail(char **error, const tstring &message)
+{
+    if (error)
+        *error = copyBuffer(NS_Utils::TStrToUtf8(message));
+    return ISL_ERROR;
+}
+
+static int succeed(char **out, size_t *out_size, const std::string &data)
+{
+    *out = copyBuffer(data);
+    if (!*out)
+        return ISL_ERROR;
+    if (out_size)
+        *out_size = data.size();
+    return ISL_OK;
+}
+
+static ISLBinOptions makeOptions(unsigned flags, const char *source_locale, const char *locales)
+{
+    ISLBinOptions options;
+    options.segments = (flags & ISL_COMPILE_PLACEHOLDERS) != 0;
+    options.utf16 = (flags & ISL_COMPILE_UTF16) != 0;
+    options.namespaces = (flags & ISL_COMPILE_NAMESPACES) != 0;
+    if (source_locale)
+        options.sourceLocale = NS_Utils::Utf8ToTStr(source_locale);
+    if (locales) {
+        tstring list = NS_Utils::Utf8ToTStr(locales);
+        size_t pos = 0;
+        while (pos < list.length()) {
+            size_t end = list.find(_T(','), pos);
+            if (end == tstring::npos)
+                end = list.length();
+            if (end > pos)
+                options.locales.push_back(list.substr(pos, end - pos));
+            pos = end + 1;
+        }
+    }
+    return options;
+}
+
+static bool parseText(const char *text, size_t size, const ISLBinOptions &options, ISLParser &isl, tstring &error)
+{
+    isl.setBinOptions(options);
+    if (!isl.parseData(std::string(text, size), error))
+        return false;
+    if (isl.translationsMap().empty()) {
+        error = _T("translations map is empty!");
+        return false;
+    }
+    return !options.segments || NS_Format::checkPlaceholders(isl.translationsMap(), options.sourceLocale, error);
+}
+
+int isl_compile(const char *text, size_t size, unsigned flags, const char *source_locale, const char *locales,
+                char **out, size_t *out_size, char **error)
+{
+    if (!out)
+        return fail(error, _T("invalid arguments"));
+    *out = nullptr;
+    if (!text && size != 0)
+        return fail(error, _T("invalid arguments"));
+    try {
+        ISLBinOptions options = makeOptions(flags, source_locale, locales);
+        ISLParser isl;
+        tstring err;
+        if (!parseText(text, size, options, isl, err))
+            return fail(error, err);
+        std::string data;
+        if (!NS_Format::serialize(isl.translationsMap(), data, options, &isl.messagesMap()))
+            return fail(error, _T("cannot serialize translations"));
+        return succeed(out, out_size, data);
+    } catch (const std::exception &e) {
+        return fail(error, NS_Utils::Utf8ToTStr(e.what()));
+    }
+}
+
+int isl_verify(const char *data, size_t size, unsigned flags, const char *source_locale, char **error)
+{
+    if (!data && size != 0)
+        return fail(error, _T("invalid arguments"));
+    try {
+        ISLHeader header;
+        if (NS_Format::readHeader(data, size, header)) {
+            // Same checksum and hash checks as --verify, then the records themselves
+            tstring err;
+            auto read = [data, size](size_t offset, char *buf, size_t length) -> size_t {
+                size_t n = offset < size ? std::min(length, size - offset) : 0;
+                memcpy(buf, data + offset, n);
+                return n;
+            };
+            if (!NS_Format::verify(size, read, err))
+                return fail(error, err);
+            TranslationsMap translMap;
+            SegmentsMap segmentsMap;
+            if (!NS_Format::deserialize(data, size, translMap, &segmentsMap))
+                return fail(error, _T("corrupted BIN data"));
+            return ISL_OK;
+        }
+        ISLParser isl;
+        tstring err;
+        if (!parseText(data, size, makeOptions(flags, source_locale, nullptr), isl, err))
+            return fail(error, err);
+        return ISL_OK;
+    } catch (const std::exception &e) {
+        return fail(error, NS_Utils::Utf8ToTStr(e.what()));
+    }
+}
+
+int isl_decode(const char *data, size_t size, char **out, size_t *out_size, char **error)
+{
+    if (!out || (!data && size != 0))
+        return fail(error, _T("invalid arguments"));
+    *out = nullptr;
+    try {
+        TranslationsMap translMap;
+        if (!NS_Format::deserialize(data, size, translMap))
+            return fail(error, _T("not a BIN file or corrupted data"));
+        std::string text;
+        ISLParser::formatTranslations(translMap, text);
+        return succeed(out, out_size, text);
+    } catch (const std::exception &e) {
+        return fail(error, NS_Utils::Utf8ToTStr(e.what()));
+    }
+}
+
+void isl_free(void *ptr)
+{
+    free(ptr);
+}
+
+const char* isl_version(void)
+{
+    return VER_FILEVERSION_STR;
+}
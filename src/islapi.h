@@ -0,0 +1,55 @@
+#ifndef ISLAPI_H
+#define ISLAPI_H
+
+#include <stddef.h>
+
+#ifdef _WIN32
+# ifdef ISL_LIBRARY
+#  define ISL_API __declspec(dllexport)
+# else
+#  define ISL_API __declspec(dllimport)
+# endif
+#else
+# define ISL_API __attribute__((visibility("default")))
+#endif
+
+#define ISL_OK     0
+#define ISL_ERROR -1
+
+/* isl_compile() flags */
+#define ISL_COMPILE_PLACEHOLDERS 0x1
+#define ISL_COMPILE_UTF16        0x2
+#define ISL_COMPILE_NAMESPACES   0x4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * All text is UTF-8. Output buffers and error messages are allocated by the
+ * library, release them with isl_free(). On failure *out is set to NULL and
+ * *error (if not NULL) receives a message.
+ */
+
+/* Compile ISL source text into bundle bytes. source_locale and locales
+   (comma-separated, '*' and '?' allowed) may be NULL for the defaults. */
+ISL_API int isl_compile(const char *text, size_t size, unsigned flags,
+                        const char *source_locale, const char *locales,
+                        char **out, size_t *out_size, char **error);
+
+/* Check ISL source text, or bundle bytes if the data starts with the bundle magic */
+ISL_API int isl_verify(const char *data, size_t size, unsigned flags,
+                       const char *source_locale, char **error);
+
+/* Decode bundle bytes back into ISL source text */
+ISL_API int isl_decode(const char *data, size_t size, char **out, size_t *out_size, char **error);
+
+ISL_API void isl_free(void *ptr);
+
+ISL_API const char* isl_version(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ISLAPI_H
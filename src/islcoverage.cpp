@@ -0,0 +1,191 @@
+#include "islcoverage.h"
+#include "utils.h"
+#include <algorithm>
+#ifdef _MSC_VER
+# include <intrin.h>
+# define popcount64(x) __popcnt64(x)
+# define ctz64(x) _tzcnt_u64(x)
+#else
+# define popcount64(x) __builtin_popcountll(x)
+# define ctz64(x) __builtin_ctzll(x)
+#endif
+
+
+static tstring jsonString(const tstring &str)
+{
+    tstring out(_T("\""));
+    for (tchar c : str) {
+        if (c == _T('"') || c == _T('\\'))
+            out.push_back(_T('\\'));
+        out.push_back(c);
+    }
+    out.push_back(_T('"'));
+    return out;
+}
+
+static tstring percent(size_t part, size_t total)
+{
+    size_t p = total == 0 ? 1000 : part * 1000 / total;
+    return to_tstring(p / 10) + _T(".") + to_tstring(p % 10) + _T("%");
+}
+
+ISLCoverage::ISLCoverage() :
+    words(0),
+    hasSource(false)
+{
+
+}
+
+ISLCoverage::~ISLCoverage()
+{
+
+}
+
+void ISLCoverage::build(const TranslationsMap &translMap, const tstring &sourceLocale)
+{
+    ids.clear();
+    locales.clear();
+    source = sourceLocale;
+    ids.reserve(translMap.size());
+    std::unordered_map<tstring, size_t> localeIndex;
+    for (auto it = translMap.cbegin(); it != translMap.cend(); ++it) {
+        ids.push_back(it->first);
+        for (auto loc_it = it->second.cbegin(); loc_it != it->second.cend(); ++loc_it) {
+            if (localeIndex.find(loc_it->first) == localeIndex.end()) {
+                localeIndex[loc_it->first] = 0;
+                locales.push_back(loc_it->first);
+            }
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    std::sort(locales.begin(), locales.end());
+    for (size_t i = 0; i < locales.size(); i++)
+        localeIndex[locales[i]] = i;
+
+    // One row of bits per locale, one bit per string ID
+    words = (ids.size() + 63) / 64;
+    matrix.assign(locales.size() * words, 0);
+    for (size_t i = 0; i < ids.size(); i++) {
+        const LocaleMap &localeMap = translMap.at(ids[i]);
+        for (auto loc_it = localeMap.cbegin(); loc_it != localeMap.cend(); ++loc_it)
+            matrix[localeIndex[loc_it->first] * words + i / 64] |= 1ULL << (i % 64);
+    }
+
+    auto src_it = localeIndex.find(source);
+    hasSource = src_it != localeIndex.end();
+    if (hasSource) {
+        const uint64_t *src = row(src_it->second);
+        reference.assign(src, src + words);
+    } else {
+        reference.assign(words, 0);
+        for (size_t i = 0; i < locales.size(); i++) {
+            const uint64_t *bits = row(i);
+            for (size_t w = 0; w < words; w++)
+                reference[w] |= bits[w];
+        }
+    }
+}
+
+tstring ISLCoverage::report(bool json) const
+{
+    size_t total = count(reference.data());
+    std::vector<uint64_t> all(words, 0);
+    for (size_t i = 0; i < locales.size(); i++) {
+        const uint64_t *bits = row(i);
+        for (size_t w = 0; w < words; w++)
+            all[w] |= bits[w];
+    }
+    std::vector<tstring> orphans = missingIds(reference.data(), all.data());
+
+    tstring out;
+    if (json) {
+        out.append(_T("{\n  \"source\": ") + jsonString(hasSource ? source : tstring()));
+        out.append(_T(",\n  \"ids\": ") + to_tstring(total));
+        out.append(_T(",\n  \"locales\": ["));
+        for (size_t i = 0; i < locales.size(); i++) {
+            std::vector<tstring> missing = missingIds(row(i), reference.data());
+            out.append(i == 0 ? _T("\n") : _T(",\n"));
+            out.append(_T("    {\"locale\": ") + jsonString(locales[i]));
+            out.append(_T(", \"translated\": ") + to_tstring(total - missing.size()));
+            out.append(_T(", \"missing\": ["));
+            for (size_t j = 0; j < missing.size(); j++)
+                out.append((j == 0 ? _T("") : _T(", ")) + jsonString(missing[j]));
+            out.append(_T("]}"));
+        }
+        out.append(_T("\n  ],\n  \"orphans\": ["));
+        for (size_t j = 0; j < orphans.size(); j++)
+            out.append((j == 0 ? _T("") : _T(", ")) + jsonString(orphans[j]));
+        out.append(_T("]\n}\n"));
+        return out;
+    }
+
+    out.append(_T("\nTranslation coverage\n"));
+    out.append(_T("============================\n"));
+    if (hasSource)
+        out.append(_T("Source locale: ") + source + _T(", IDs: ") + to_tstring(total) + _T("\n"));
+    else
+        out.append(_T("Source locale ") + source + _T(" not found, using all IDs: ") + to_tstring(total) + _T("\n"));
+    for (size_t i = 0; i < locales.size(); i++) {
+        size_t missing = countMissing(row(i), reference.data());
+        out.append(locales[i] + _T(": ") + to_tstring(total - missing) + _T("/") + to_tstring(total)
+                   + _T(" (") + percent(total - missing, total) + _T(")\n"));
+        if (missing != 0) {
+            std::vector<tstring> missingList = missingIds(row(i), reference.data());
+            out.append(_T("  missing:"));
+            for (const tstring &id : missingList)
+                out.append(_T(" ") + id);
+            out.append(_T("\n"));
+        }
+    }
+    if (!orphans.empty()) {
+        out.append(_T("Orphan IDs (not in ") + source + _T("):"));
+        for (const tstring &id : orphans)
+            out.append(_T(" ") + id);
+        out.append(_T("\n"));
+    }
+    return out;
+}
+
+bool ISLCoverage::isComplete() const
+{
+    // IDs missing from the source locale are reported, but do not make the result incomplete
+    for (size_t i = 0; i < locales.size(); i++) {
+        if (countMissing(row(i), reference.data()) != 0)
+            return false;
+    }
+    return true;
+}
+
+const uint64_t* ISLCoverage::row(size_t localeIndex) const
+{
+    return matrix.data() + localeIndex * words;
+}
+
+size_t ISLCoverage::count(const uint64_t *bits) const
+{
+    size_t n = 0;
+    for (size_t w = 0; w < words; w++)
+        n += popcount64(bits[w]);
+    return n;
+}
+
+size_t ISLCoverage::countMissing(const uint64_t *bits, const uint64_t *ref) const
+{
+    size_t n = 0;
+    for (size_t w = 0; w < words; w++)
+        n += popcount64(ref[w] & ~bits[w]);
+    return n;
+}
+
+std::vector<tstring> ISLCoverage::missingIds(const uint64_t *bits, const uint64_t *ref) const
+{
+    std::vector<tstring> missing;
+    for (size_t w = 0; w < words; w++) {
+        uint64_t diff = ref[w] & ~bits[w];
+        while (diff != 0) {
+            missing.push_back(ids[w * 64 + ctz64(diff)]);
+            diff &= diff - 1;
+        }
+    }
+    return missing;
+}
@@ -0,0 +1,33 @@
+#ifndef ISLCOVERAGE_H
+#define ISLCOVERAGE_H
+
+#include "islparser.h"
+#include <cstdint>
+
+
+class ISLCoverage
+{
+public:
+    ISLCoverage();
+    ~ISLCoverage();
+
+    void build(const TranslationsMap &translMap, const tstring &sourceLocale);
+    tstring report(bool json) const;
+    bool isComplete() const;
+
+private:
+    const uint64_t* row(size_t localeIndex) const;
+    size_t count(const uint64_t *bits) const;
+    size_t countMissing(const uint64_t *bits, const uint64_t *ref) const;
+    std::vector<tstring> missingIds(const uint64_t *bits, const uint64_t *ref) const;
+
+    std::vector<tstring>  ids,
+                          locales;
+    std::vector<uint64_t> matrix,
+                          reference;
+    tstring source;
+    size_t  words;
+    bool    hasSource;
+};
+
+#endif // ISLCOVERAGE_H
@@ -0,0 +1,1354 @@
+#include "islformat.h"
+#include "crc32c.h"
+#include "islplural.h"
+#include "utf16.h"
+#include "threadpool.h"
+#include "utils.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <set>
+
+#define SERIALIZE_SHARD_RECORDS 2048
+
+typedef std::pair<std::string, std::string> LocaleRecord;
+
+struct IdRecord
+{
+    std::string id;
+    std::vector<LocaleRecord> locales;
+    size_t rank;
+    size_t prefix;  // namespace prefix length in id
+};
+
+// A namespace's slice of one section, checksummed while verify() streams the bundle
+struct NamespaceRange
+{
+    size_t   offset,
+             size,
+             ns;
+    uint32_t crc;
+};
+
+// Payload offsets just past a record, used for namespace ranges
+struct RecordEnd
+{
+    size_t   records,
+             utf16,
+             segments,
+             variants;
+    uint32_t variantCount;
+};
+
+
+template<typename Str>
+static bool splitValue(const Str &value, std::vector<ISLSegment> &segments, std::vector<Str> &names)
+{
+    // Segment offsets are 16-bit, longer values cannot carry placeholders
+    size_t pos = 0, literal = 0, len = value.length();
+    if (len > UINT16_MAX)
+        return false;
+    auto addSegment = [&segments](uint8_t kind, uint8_t arg, size_t offset, size_t length) {
+        ISLSegment seg;
+        seg.kind = kind;
+        seg.arg = arg;
+        seg.offset = (uint16_t)offset;
+        seg.length = (uint16_t)length;
+        segments.push_back(seg);
+    };
+    while (pos < len) {
+        size_t end = pos + 1;
+        uint8_t kind = ISL_SEGMENT_LITERAL, arg = 0;
+        if (value[pos] == '%') {
+            while (end < len && end - pos < 3 && value[end] >= '0' && value[end] <= '9')
+                end++;
+            if (end - pos > 1 && value[pos + 1] != '0') {
+                kind = ISL_SEGMENT_INDEX;
+                for (size_t i = pos + 1; i < end; i++)
+                    arg = arg * 10 + (value[i] - '0');
+            }
+        } else
+        if (value[pos] == '{') {
+            while (end < len && ((value[end] >= 'a' && value[end] <= 'z') || (value[end] >= 'A' && value[end] <= 'Z')
+                                 || (value[end] >= '0' && value[end] <= '9') || value[end] == '_'))
+                end++;
+            if (end < len && end - pos > 1 && value[end] == '}') {
+                kind = ISL_SEGMENT_NAME;
+                names.push_back(value.substr(pos + 1, end - pos - 1));
+                end++;
+            }
+        }
+        if (kind == ISL_SEGMENT_LITERAL) {
+            pos = end;
+            continue;
+        }
+        if (pos > literal)
+            addSegment(ISL_SEGMENT_LITERAL, 0, literal, pos - literal);
+        addSegment(kind, arg, pos, end - pos);
+        pos = literal = end;
+    }
+    if (len > literal)
+        addSegment(ISL_SEGMENT_LITERAL, 0, literal, len - literal);
+    return true;
+}
+
+template<typename T>
+static void appendValue(std::string &data, T val)
+{
+    data.append((const char*)&val, sizeof(val));
+}
+
+template<typename T>
+static bool appendString(std::string &data, const std::string &str)
+{
+    if (str.length() > (T)-1)
+        return false;
+    appendValue<T>(data, (T)str.length());
+    data.append(str);
+    return true;
+}
+
+template<typename T>
+static bool readValue(const char *&it, const char *end, T &val)
+{
+    if ((size_t)(end - it) < sizeof(val))
+        return false;
+    memcpy(&val, it, sizeof(val));
+    it += sizeof(val);
+    return true;
+}
+
+template<typename T>
+static bool readString(const char *&it, const char *end, tstring &str)
+{
+    T len = 0;
+    if (!readValue<T>(it, end, len) || (size_t)(end - it) < len)
+        return false;
+    str = NS_Utils::Utf8ToTStr(std::string(it, len));
+    it += len;
+    return true;
+}
+
+struct EncodedShard
+{
+    std::string records,
+                utf16,
+                segments;
+    std::vector<size_t> utf16Offsets;
+    bool ok;
+};
+
+static void forEachShard(ThreadPool *pool, size_t count, const std::function<void(size_t)> &task)
+{
+    if (!pool) {
+        for (size_t i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+        pool->submit([&task, i]() {
+            task(i);
+        });
+    pool->wait();
+}
+
+static uint32_t tableCrc(const char *data, size_t size)
+{
+    // Covers magic, version, flags and the section table, the content hash is checked by verifyBinFile
+    return crc32c(crc32c(0, data, 8), data + ISL_HEADER_SIZE, size - ISL_HEADER_SIZE);
+}
+
+static bool writeRecords(const IdRecord *begin, const IdRecord *end, std::string &data, std::string *utf16,
+                         std::vector<size_t> *utf16Offsets)
+{
+    // UTF-16 offsets are relative to this shard's pool, their positions are kept for relocation
+    for (const IdRecord *rec_it = begin; rec_it != end; ++rec_it) {
+        const IdRecord &rec = *rec_it;
+        if (!appendString<uint8_t>(data, rec.id) || rec.locales.size() > UINT16_MAX)
+            return false;
+        appendValue<uint16_t>(data, rec.locales.size());
+        for (const LocaleRecord &loc : rec.locales) {
+            if (!appendString<uint8_t>(data, loc.first))
+                return false;
+            if (!utf16) {
+                if (!appendString<uint16_t>(data, loc.second))
+                    return false;
+                continue;
+            }
+            size_t offset = utf16->size() / 2;
+            if (!utf8ToUtf16le(loc.second.data(), loc.second.size(), *utf16)
+                    || offset > UINT32_MAX || utf16->size() / 2 - offset > UINT16_MAX)
+                return false;
+            utf16Offsets->push_back(data.size());
+            appendValue<uint32_t>(data, offset);
+            appendValue<uint16_t>(data, utf16->size() / 2 - offset);
+            utf16->append(2, '\0');
+        }
+    }
+    return true;
+}
+
+static bool writeSegments(const IdRecord *begin, const IdRecord *end, std::string &data)
+{
+    for (const IdRecord *rec_it = begin; rec_it != end; ++rec_it) {
+        const IdRecord &rec = *rec_it;
+        std::vector<std::vector<ISLSegment>> localeSegments(rec.locales.size());
+        std::vector<std::vector<std::string>> localeNames(rec.locales.size());
+        std::vector<std::string> names;
+        for (size_t i = 0; i < rec.locales.size(); i++) {
+            if (!splitValue(rec.locales[i].second, localeSegments[i], localeNames[i]))
+                return false;
+            names.insert(names.end(), localeNames[i].begin(), localeNames[i].end());
+        }
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+        if (names.size() > UINT8_MAX)
+            return false;
+
+        appendValue<uint8_t>(data, names.size());
+        for (const std::string &name : names) {
+            if (!appendString<uint8_t>(data, name))
+                return false;
+        }
+        for (size_t i = 0; i < rec.locales.size(); i++) {
+            std::vector<ISLSegment> &segments = localeSegments[i];
+            if (segments.size() > UINT8_MAX)
+                return false;
+            appendValue<uint8_t>(data, segments.size());
+            size_t nameIndex = 0;
+            for (ISLSegment &seg : segments) {
+                if (seg.kind == ISL_SEGMENT_NAME)
+                    seg.arg = std::lower_bound(names.begin(), names.end(), localeNames[i][nameIndex++]) - names.begin();
+                appendValue<uint8_t>(data, seg.kind);
+                appendValue<uint8_t>(data, seg.arg);
+                appendValue<uint16_t>(data, seg.offset);
+                appendValue<uint16_t>(data, seg.length);
+            }
+        }
+    }
+    return true;
+}
+
+static bool writeVariants(const std::vector<IdRecord> &records, const MessagesMap *messages, std::string &rulesData,
+                          std::string &data, RecordEnd *ends = nullptr)
+{
+    // Rule sets are shared by all locales of a language and stored once
+    std::vector<tstring> ruleNames;
+    std::vector<ISLPluralRules> ruleSets;
+    std::unordered_map<std::string, size_t> localeRuleSets;
+    uint32_t count = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        const IdRecord &rec = records[i];
+        for (const LocaleRecord &loc : rec.locales) {
+            if (loc.second.find('{') == std::string::npos || loc.second.find(',') == std::string::npos)
+                continue;
+            // Messages the parser kept are reused, other callers' values are parsed here
+            std::string encoded;
+            const std::string *nodes = &encoded;
+            if (messages) {
+                auto id_it = messages->find(NS_Utils::Utf8ToTStr(rec.id));
+                if (id_it == messages->end())
+                    continue;
+                auto msg_it = id_it->second.find(NS_Utils::Utf8ToTStr(loc.first));
+                if (msg_it == id_it->second.end())
+                    continue;
+                nodes = &msg_it->second;
+            } else {
+                ISLMessage message;
+                size_t errorPos = 0;
+                const tchar *error = nullptr;
+                if (!NS_Plural::parseMessage(NS_Utils::Utf8ToTStr(loc.second), message, errorPos, error))
+                    return false;
+                if (!NS_Plural::hasVariants(message))
+                    continue;
+                if (!NS_Format::encodeMessage(message, encoded))
+                    return false;
+            }
+
+            // Rules are compiled once per locale
+            auto set_it = localeRuleSets.find(loc.first);
+            if (set_it == localeRuleSets.end()) {
+                tstring name;
+                ISLPluralRules rules;
+                if (!NS_Plural::findRules(NS_Utils::Utf8ToTStr(loc.first), name, rules))
+                    name.clear();
+                size_t index = std::find(ruleNames.begin(), ruleNames.end(), name) - ruleNames.begin();
+                if (index == ruleNames.size()) {
+                    ruleNames.push_back(name);
+                    ruleSets.push_back(rules);
+                }
+                set_it = localeRuleSets.insert(std::make_pair(loc.first, index)).first;
+            }
+            size_t ruleSet = set_it->second;
+            if (ruleSet > UINT8_MAX)
+                return false;
+
+            if (!appendString<uint8_t>(data, rec.id) || !appendString<uint8_t>(data, loc.first))
+                return false;
+            appendValue<uint8_t>(data, ruleSet);
+            data.append(*nodes);
+            count++;
+        }
+        if (ends) {
+            // Counted from the start of the section, the count is inserted in front below
+            ends[i].variants = sizeof(count) + data.size();
+            ends[i].variantCount = count;
+        }
+    }
+    if (count == 0)
+        return true;
+    data.insert(0, (const char*)&count, sizeof(count));
+
+    appendValue<uint8_t>(rulesData, ruleSets.size());
+    for (size_t i = 0; i < ruleSets.size(); i++) {
+        if (!appendString<uint8_t>(rulesData, NS_Utils::TStrToUtf8(ruleNames[i])))
+            return false;
+        appendValue<uint8_t>(rulesData, ruleSets[i].size());
+        for (const ISLPluralRule &rule : ruleSets[i]) {
+            appendValue<uint8_t>(rulesData, rule.category);
+            appendValue<uint8_t>(rulesData, rule.clauses.size());
+            for (const ISLPluralClause &clause : rule.clauses) {
+                appendValue<uint8_t>(rulesData, clause.size());
+                for (const ISLPluralTerm &term : clause) {
+                    appendValue<uint32_t>(rulesData, term.mod);
+                    appendValue<uint8_t>(rulesData, term.negate);
+                    appendValue<uint8_t>(rulesData, term.ranges.size());
+                    for (const ISLPluralRange &range : term.ranges) {
+                        appendValue<uint32_t>(rulesData, range.lo);
+                        appendValue<uint32_t>(rulesData, range.hi);
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static uint32_t rangeCrc(uint32_t crc, const std::vector<std::string> &parts, size_t offset, size_t size)
+{
+    for (const std::string &part : parts) {
+        if (size == 0)
+            break;
+        if (offset >= part.size()) {
+            offset -= part.size();
+            continue;
+        }
+        size_t len = std::min(size, part.size() - offset);
+        crc = crc32c(crc, part.data() + offset, len);
+        size -= len;
+        offset = 0;
+    }
+    return crc;
+}
+
+static bool writeNamespaces(const std::vector<IdRecord> &records, const std::vector<RecordEnd> &ends,
+                            const std::vector<std::string> *payloads[4], std::string &data)
+{
+    // Records of a namespace are contiguous, so each namespace takes one range per payload
+    struct TrieNode
+    {
+        uint8_t  byte;
+        uint16_t ns;
+        std::map<uint8_t, size_t> children;
+    };
+    std::vector<TrieNode> trie(1);
+    trie[0].byte = 0;
+    trie[0].ns = ISL_NAMESPACE_NONE;
+    std::string entries;
+    uint16_t count = 0;
+    RecordEnd start = { sizeof(uint16_t), 0, 0, sizeof(uint32_t), 0 };
+    for (size_t first = 0; first < records.size(); ) {
+        const std::string prefix = records[first].id.substr(0, records[first].prefix);
+        size_t last = first + 1;
+        while (last < records.size() && records[last].id.compare(0, records[last].prefix, prefix) == 0)
+            last++;
+        const RecordEnd &end = ends[last - 1];
+        const size_t begins[4] = { start.records, start.utf16, start.segments, start.variants };
+        const size_t finishes[4] = { end.records, end.utf16, end.segments, end.variants };
+        if (!appendString<uint8_t>(entries, prefix))
+            return false;
+        appendValue<uint16_t>(entries, last - first);
+        appendValue<uint32_t>(entries, end.variantCount - start.variantCount);
+        uint32_t crc = 0;
+        for (int i = 0; i < 4; i++) {
+            if (payloads[i])
+                crc = rangeCrc(crc, *payloads[i], begins[i], finishes[i] - begins[i]);
+        }
+        appendValue<uint32_t>(entries, crc);
+        for (int i = 0; i < 4; i++) {
+            appendValue<uint32_t>(entries, payloads[i] ? begins[i] : 0);
+            appendValue<uint32_t>(entries, payloads[i] ? finishes[i] - begins[i] : 0);
+        }
+
+        size_t node = 0;
+        for (char c : prefix) {
+            auto it = trie[node].children.find((uint8_t)c);
+            if (it == trie[node].children.end()) {
+                TrieNode child;
+                child.byte = (uint8_t)c;
+                child.ns = ISL_NAMESPACE_NONE;
+                trie.push_back(child);
+                it = trie[node].children.insert(std::make_pair((uint8_t)c, trie.size() - 1)).first;
+            }
+            node = it->second;
+        }
+        trie[node].ns = count++;
+        start = end;
+        first = last;
+    }
+    appendValue<uint16_t>(data, count);
+    data.append(entries);
+
+    // Nodes are stored breadth-first, which keeps the children of a node next to each other
+    std::vector<size_t> order(1, 0);
+    for (size_t i = 0; i < order.size(); i++) {
+        for (const auto &child : trie[order[i]].children)
+            order.push_back(child.second);
+    }
+    appendValue<uint32_t>(data, order.size());
+    size_t next = 1;
+    for (size_t i : order) {
+        const TrieNode &node = trie[i];
+        appendValue<uint8_t>(data, node.byte);
+        appendValue<uint16_t>(data, node.children.size());
+        appendValue<uint32_t>(data, node.children.empty() ? 0 : next);
+        appendValue<uint16_t>(data, node.ns);
+        next += node.children.size();
+    }
+    return true;
+}
+
+static const uint32_t NAMESPACE_SECTIONS[4] = { ISL_SECTION_RECORDS, ISL_SECTION_UTF16, ISL_SECTION_SEGMENTS,
+                                                  ISL_SECTION_VARIANTS };
+
+static const ISLSection* findSection(const std::vector<ISLSection> &sections, uint32_t id)
+{
+    for (const ISLSection &section : sections) {
+        if (section.id == id)
+            return &section;
+    }
+    return nullptr;
+}
+
+static void namespaceRanges(const ISLNamespace &ns, const ISLRange *ranges[4])
+{
+    ranges[0] = &ns.records;
+    ranges[1] = &ns.utf16;
+    ranges[2] = &ns.segments;
+    ranges[3] = &ns.variants;
+}
+
+static bool readNamespaceIndex(const char *&it, const char *end, ISLNamespaceIndex &index)
+{
+    // index.sections must be set, every range has to fall inside its section
+    uint16_t count = 0;
+    if (!readValue<uint16_t>(it, end, count))
+        return false;
+    index.namespaces.resize(count);
+    for (ISLNamespace &ns : index.namespaces) {
+        if (!readString<uint8_t>(it, end, ns.prefix) || !readValue<uint16_t>(it, end, ns.idCount)
+                || !readValue<uint32_t>(it, end, ns.variantCount) || !readValue<uint32_t>(it, end, ns.crc))
+            return false;
+        for (ISLRange *range : { &ns.records, &ns.utf16, &ns.segments, &ns.variants }) {
+            if (!readValue<uint32_t>(it, end, range->offset) || !readValue<uint32_t>(it, end, range->size))
+                return false;
+        }
+        const ISLRange *ranges[4];
+        namespaceRanges(ns, ranges);
+        for (int i = 0; i < 4; i++) {
+            const ISLSection *section = findSection(index.sections, NAMESPACE_SECTIONS[i]);
+            if (ranges[i]->size != 0 && (!section || ranges[i]->offset > section->size
+                                         || section->size - ranges[i]->offset < ranges[i]->size))
+                return false;
+        }
+        if (ns.records.size == 0)
+            return false;
+    }
+    uint32_t nodeCount = 0;
+    if (!readValue<uint32_t>(it, end, nodeCount) || nodeCount == 0 || (size_t)(end - it) / 9 < nodeCount)
+        return false;
+    index.nodes.resize(nodeCount);
+    for (size_t i = 0; i < index.nodes.size(); i++) {
+        ISLNamespaceNode &node = index.nodes[i];
+        readValue<uint8_t>(it, end, node.byte);
+        readValue<uint16_t>(it, end, node.childCount);
+        readValue<uint32_t>(it, end, node.firstChild);
+        readValue<uint16_t>(it, end, node.ns);
+        // Children follow their parent, so a lookup always ends
+        if ((node.childCount != 0 && node.firstChild <= i) || (uint64_t)node.firstChild + node.childCount > nodeCount
+                || (node.ns != ISL_NAMESPACE_NONE && node.ns >= count))
+            return false;
+    }
+    // Lookups binary search the children
+    for (const ISLNamespaceNode &node : index.nodes) {
+        for (size_t i = 1; i < node.childCount; i++) {
+            if (index.nodes[node.firstChild + i - 1].byte >= index.nodes[node.firstChild + i].byte)
+                return false;
+        }
+    }
+    return it == end;
+}
+
+static bool readPluralRules(const char *&it, const char *end, ISLVariants &variants)
+{
+    uint8_t setCount = 0;
+    if (!readValue<uint8_t>(it, end, setCount))
+        return false;
+    variants.rules.resize(setCount);
+    for (auto &ruleSet : variants.rules) {
+        uint8_t ruleCount = 0;
+        if (!readString<uint8_t>(it, end, ruleSet.first) || !readValue<uint8_t>(it, end, ruleCount))
+            return false;
+        ruleSet.second.resize(ruleCount);
+        for (ISLPluralRule &rule : ruleSet.second) {
+            uint8_t clauseCount = 0;
+            if (!readValue<uint8_t>(it, end, rule.category) || !readValue<uint8_t>(it, end, clauseCount))
+                return false;
+            rule.clauses.resize(clauseCount);
+            for (ISLPluralClause &clause : rule.clauses) {
+                uint8_t termCount = 0;
+                if (!readValue<uint8_t>(it, end, termCount))
+                    return false;
+                clause.resize(termCount);
+                for (ISLPluralTerm &term : clause) {
+                    uint8_t rangeCount = 0;
+                    if (!readValue<uint32_t>(it, end, term.mod) || !readValue<uint8_t>(it, end, term.negate)
+                            || !readValue<uint8_t>(it, end, rangeCount))
+                        return false;
+                    term.ranges.resize(rangeCount);
+                    for (ISLPluralRange &range : term.ranges) {
+                        if (!readValue<uint32_t>(it, end, range.lo) || !readValue<uint32_t>(it, end, range.hi))
+                            return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static bool readVariants(const char *&it, const char *end, uint32_t count, size_t ruleSets, ISLVariants &variants)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        tstring id, locale;
+        uint16_t nodeCount = 0;
+        ISLMessage message;
+        if (!readString<uint8_t>(it, end, id) || !readString<uint8_t>(it, end, locale)
+                || !readValue<uint8_t>(it, end, message.rules) || !readValue<uint16_t>(it, end, nodeCount)
+                || message.rules >= ruleSets)
+            return false;
+        message.nodes.resize(nodeCount);
+        for (size_t j = 0; j < message.nodes.size(); j++) {
+            ISLVariantNode &node = message.nodes[j];
+            node.category = 0;
+            node.value = 0;
+            node.size = 0;
+            if (!readValue<uint8_t>(it, end, node.kind))
+                return false;
+            bool valid = true;
+            switch (node.kind) {
+            case ISL_VARIANT_TEXT:
+                valid = readString<uint16_t>(it, end, node.text);
+                break;
+            case ISL_VARIANT_HASH:
+                break;
+            case ISL_VARIANT_INDEX: {
+                uint8_t arg = 0;
+                valid = readValue<uint8_t>(it, end, arg);
+                node.value = arg;
+                break;
+            }
+            case ISL_VARIANT_NAME:
+                valid = readString<uint8_t>(it, end, node.text);
+                break;
+            case ISL_VARIANT_PLURAL:
+            case ISL_VARIANT_SELECT:
+                valid = readString<uint8_t>(it, end, node.text) && readValue<uint16_t>(it, end, node.size);
+                break;
+            case ISL_VARIANT_CASE:
+                valid = readValue<uint8_t>(it, end, node.category) && readValue<uint32_t>(it, end, node.value)
+                        && readString<uint8_t>(it, end, node.text) && readValue<uint16_t>(it, end, node.size);
+                break;
+            default:
+                valid = false;
+                break;
+            }
+            if (!valid || j + node.size >= message.nodes.size())
+                return false;
+        }
+        variants.messages[id][locale] = std::move(message);
+    }
+    return true;
+}
+
+static bool readValueUtf16(const char *&it, const char *end, const char *utf16, size_t utf16Units, tstring &value)
+{
+    uint32_t offset = 0;
+    uint16_t length = 0;
+    if (!readValue<uint32_t>(it, end, offset) || !readValue<uint16_t>(it, end, length)
+            || offset > utf16Units || utf16Units - offset < length)
+        return false;
+#ifdef _WIN32
+    // wchar_t is UTF-16 here, the units are taken as they are
+    value.resize(length);
+    if (length != 0)
+        memcpy(&value[0], utf16 + (size_t)offset * 2, (size_t)length * 2);
+    return true;
+#else
+    value.clear();
+    return utf16leToUtf8(utf16 + (size_t)offset * 2, length, value);
+#endif
+}
+
+static bool readRecords(const char *&it, const char *end, uint16_t mapSize, TranslationsMap &translMap,
+                        std::vector<std::pair<tstring, std::vector<tstring>>> *order,
+                        const char *utf16 = nullptr, size_t utf16Units = 0)
+{
+    translMap.reserve(mapSize);
+    for (uint16_t i = 0; i < mapSize; i++) {
+        tstring key;
+        uint16_t localeSize = 0;
+        if (!readString<uint8_t>(it, end, key) || !readValue<uint16_t>(it, end, localeSize))
+            return false;
+
+        LocaleMap &localeMap = translMap[key];
+        if (order)
+            order->push_back(std::make_pair(key, std::vector<tstring>()));
+        for (uint16_t j = 0; j < localeSize; j++) {
+            tstring locale, value;
+            if (!readString<uint8_t>(it, end, locale))
+                return false;
+            if (utf16 ? !readValueUtf16(it, end, utf16, utf16Units, value) : !readString<uint16_t>(it, end, value))
+                return false;
+            if (order)
+                order->back().second.push_back(locale);
+            localeMap[locale] = value;
+        }
+    }
+    return true;
+}
+
+static bool readSegments(const char *&it, const char *end, const TranslationsMap &translMap,
+                         const std::vector<std::pair<tstring, std::vector<tstring>>> &order, SegmentsMap &segmentsMap)
+{
+    for (const auto &rec : order) {
+        ISLSegmentTable &table = segmentsMap[rec.first];
+        uint8_t nameCount = 0;
+        if (!readValue<uint8_t>(it, end, nameCount))
+            return false;
+        table.names.resize(nameCount);
+        for (uint8_t i = 0; i < nameCount; i++) {
+            if (!readString<uint8_t>(it, end, table.names[i]))
+                return false;
+        }
+        const LocaleMap &localeMap = translMap.at(rec.first);
+        for (const tstring &locale : rec.second) {
+            uint8_t segCount = 0;
+            if (!readValue<uint8_t>(it, end, segCount))
+                return false;
+            std::vector<ISLSegment> &segments = table.locales[locale];
+            segments.resize(segCount);
+            for (ISLSegment &seg : segments) {
+                if (!readValue<uint8_t>(it, end, seg.kind) || !readValue<uint8_t>(it, end, seg.arg)
+                        || !readValue<uint16_t>(it, end, seg.offset) || !readValue<uint16_t>(it, end, seg.length))
+                    return false;
+                if (seg.kind > ISL_SEGMENT_NAME || (seg.kind == ISL_SEGMENT_INDEX && seg.arg == 0))
+                    return false;
+            }
+#ifdef _WIN32
+            // Offsets are stored in UTF-8 bytes, remap them to wchar_t units
+            std::string value = NS_Utils::TStrToUtf8(localeMap.at(locale));
+            uint16_t offset = 0;
+            for (ISLSegment &seg : segments) {
+                if ((size_t)seg.offset + seg.length > value.length())
+                    return false;
+                uint16_t length = (uint16_t)NS_Utils::Utf8ToTStr(value.substr(seg.offset, seg.length)).length();
+                seg.offset = offset;
+                seg.length = length;
+                offset += length;
+            }
+#else
+            for (const ISLSegment &seg : segments) {
+                if ((size_t)seg.offset + seg.length > localeMap.at(locale).length())
+                    return false;
+            }
+#endif
+        }
+    }
+    return true;
+}
+
+ISLBinOptions::ISLBinOptions() :
+    segments(false),
+    utf16(false),
+    namespaces(false),
+    sourceLocale(_T("en_US")),
+    pool(nullptr)
+{
+
+}
+
+namespace NS_Format
+{
+    uint64_t contentHash(const char *data, size_t size, uint64_t hash)
+    {
+        for (size_t i = 0; i < size; i++) {
+            hash ^= (uint8_t)data[i];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    bool serialize(const TranslationsMap &translMap, std::vector<std::string> &chunks, const ISLBinOptions &options,
+                   const MessagesMap *messages)
+    {
+        // Records are converted and encoded in shards on a pool, the shard buffers are then
+        // emitted in record order, so the output does not depend on the thread count
+        std::vector<TranslationsMap::const_iterator> entries;
+        entries.reserve(translMap.size());
+        for (auto it = translMap.cbegin(); it != translMap.cend(); ++it)
+            entries.push_back(it);
+        if (entries.size() > UINT16_MAX)
+            return false;
+        size_t shardCount = std::max<size_t>(1, (entries.size() + SERIALIZE_SHARD_RECORDS - 1) / SERIALIZE_SHARD_RECORDS);
+        // Runs serially when called from a task of the pool, waiting on it there would deadlock
+        ThreadPool *pool = (shardCount > 1 && options.pool && !options.pool->isWorkerThread()) ? options.pool : nullptr;
+        auto shardBegin = [&](size_t shard) {
+            return std::min(shard * SERIALIZE_SHARD_RECORDS, entries.size());
+        };
+
+        // Sort by UTF-8 bytes rather than tchar values to get the same order on every platform
+        std::vector<IdRecord> records(entries.size());
+        forEachShard(pool, shardCount, [&](size_t shard) {
+            for (size_t i = shardBegin(shard); i < shardBegin(shard + 1); i++) {
+                IdRecord &rec = records[i];
+                rec.id = NS_Utils::TStrToUtf8(entries[i]->first);
+                rec.locales.reserve(entries[i]->second.size());
+                for (auto loc_it = entries[i]->second.cbegin(); loc_it != entries[i]->second.cend(); ++loc_it)
+                    rec.locales.push_back(LocaleRecord(NS_Utils::TStrToUtf8(loc_it->first), NS_Utils::TStrToUtf8(loc_it->second)));
+                std::sort(rec.locales.begin(), rec.locales.end());
+                size_t sep = options.namespaces ? rec.id.find(ISL_NAMESPACE_SEPARATOR) : std::string::npos;
+                rec.prefix = (sep == std::string::npos) ? 0 : sep + 1;
+            }
+        });
+        std::unordered_map<std::string, size_t> hotRank;
+        for (size_t i = 0; i < options.hotIds.size(); i++)
+            hotRank.insert(std::make_pair(NS_Utils::TStrToUtf8(options.hotIds[i]), i));
+        for (IdRecord &rec : records) {
+            auto it = hotRank.find(rec.id);
+            rec.rank = (it == hotRank.end()) ? SIZE_MAX : it->second;
+        }
+        std::sort(records.begin(), records.end(), [](const IdRecord &a, const IdRecord &b) {
+            // Namespaces stay contiguous, the profile order applies within each of them
+            int ns = a.id.compare(0, a.prefix, b.id, 0, b.prefix);
+            if (ns != 0)
+                return ns < 0;
+            return a.rank != b.rank ? a.rank < b.rank : a.id < b.id;
+        });
+
+        std::vector<EncodedShard> shards(shardCount);
+        std::vector<RecordEnd> ends(options.namespaces ? records.size() : 0);
+        forEachShard(pool, shardCount, [&](size_t shard) {
+            EncodedShard &enc = shards[shard];
+            const IdRecord *begin = records.data() + shardBegin(shard), *end = records.data() + shardBegin(shard + 1);
+            if (!options.namespaces) {
+                enc.ok = writeRecords(begin, end, enc.records, options.utf16 ? &enc.utf16 : nullptr, &enc.utf16Offsets)
+                            && (!options.segments || writeSegments(begin, end, enc.segments));
+                return;
+            }
+            enc.ok = true;
+            for (const IdRecord *rec = begin; rec != end && enc.ok; ++rec) {
+                enc.ok = writeRecords(rec, rec + 1, enc.records, options.utf16 ? &enc.utf16 : nullptr, &enc.utf16Offsets)
+                            && (!options.segments || writeSegments(rec, rec + 1, enc.segments));
+                RecordEnd &recEnd = ends[rec - records.data()];
+                recEnd.records = enc.records.size();
+                recEnd.utf16 = enc.utf16.size();
+                recEnd.segments = enc.segments.size();
+            }
+        });
+        if (options.utf16) {
+            std::vector<uint64_t> base(shardCount, 0);
+            for (size_t i = 1; i < shardCount; i++)
+                base[i] = base[i - 1] + shards[i - 1].utf16.size() / 2;
+            forEachShard(pool, shardCount, [&](size_t shard) {
+                EncodedShard &enc = shards[shard];
+                for (size_t pos : enc.utf16Offsets) {
+                    uint32_t offset;
+                    memcpy(&offset, &enc.records[pos], sizeof(offset));
+                    if (base[shard] + offset > UINT32_MAX) {
+                        enc.ok = false;
+                        return;
+                    }
+                    offset += (uint32_t)base[shard];
+                    memcpy(&enc.records[pos], &offset, sizeof(offset));
+                }
+            });
+        }
+        for (const EncodedShard &enc : shards) {
+            if (!enc.ok)
+                return false;
+        }
+        if (options.namespaces) {
+            RecordEnd base = { sizeof(uint16_t), 0, 0, 0, 0 };
+            for (size_t shard = 0; shard < shardCount; shard++) {
+                for (size_t i = shardBegin(shard); i < shardBegin(shard + 1); i++) {
+                    ends[i].records += base.records;
+                    ends[i].utf16 += base.utf16;
+                    ends[i].segments += base.segments;
+                }
+                base.records += shards[shard].records.size();
+                base.utf16 += shards[shard].utf16.size();
+                base.segments += shards[shard].segments.size();
+            }
+        }
+
+        uint32_t flags = 0;
+        std::vector<std::pair<uint32_t, std::vector<std::string>>> sections;
+        if (options.utf16) {
+            flags |= ISL_FLAG_UTF16;
+            sections.push_back(std::make_pair(ISL_SECTION_UTF16, std::vector<std::string>()));
+            for (EncodedShard &enc : shards)
+                sections.back().second.push_back(std::move(enc.utf16));
+        }
+        sections.push_back(std::make_pair(ISL_SECTION_RECORDS, std::vector<std::string>(1)));
+        appendValue<uint16_t>(sections.back().second[0], records.size());
+        for (EncodedShard &enc : shards)
+            sections.back().second.push_back(std::move(enc.records));
+        if (options.segments) {
+            flags |= ISL_FLAG_SEGMENTS;
+            sections.push_back(std::make_pair(ISL_SECTION_SEGMENTS, std::vector<std::string>()));
+            for (EncodedShard &enc : shards)
+                sections.back().second.push_back(std::move(enc.segments));
+        }
+        std::string rulesData, variantsData;
+        if (!writeVariants(records, messages, rulesData, variantsData, options.namespaces ? ends.data() : nullptr))
+            return false;
+        if (!variantsData.empty()) {
+            flags |= ISL_FLAG_VARIANTS;
+            sections.push_back(std::make_pair(ISL_SECTION_PLURAL_RULES, std::vector<std::string>(1, std::move(rulesData))));
+            sections.push_back(std::make_pair(ISL_SECTION_VARIANTS, std::vector<std::string>(1, std::move(variantsData))));
+        }
+        if (options.namespaces) {
+            auto payload = [&sections](uint32_t id) -> const std::vector<std::string>* {
+                for (const auto &section : sections) {
+                    if (section.first == id)
+                        return &section.second;
+                }
+                return nullptr;
+            };
+            const std::vector<std::string> *payloads[4] = { payload(ISL_SECTION_RECORDS), payload(ISL_SECTION_UTF16),
+                                                             payload(ISL_SECTION_SEGMENTS), payload(ISL_SECTION_VARIANTS) };
+            std::string nsData;
+            if (!writeNamespaces(records, ends, payloads, nsData))
+                return false;
+            // Ahead of the records, right after the UTF-16 section which has to stay first
+            flags |= ISL_FLAG_NAMESPACES;
+            sections.insert(sections.begin() + (options.utf16 ? 1 : 0),
+                            std::make_pair(ISL_SECTION_NAMESPACES, std::vector<std::string>(1, std::move(nsData))));
+        }
+
+        chunks.assign(1, std::string());
+        std::string &head = chunks[0];
+        head.assign(ISL_MAGIC, ISL_MAGIC_SIZE);
+        appendValue<uint8_t>(head, ISL_VERSION);
+        appendValue<uint32_t>(head, flags);
+        appendValue<uint64_t>(head, 0);
+        appendValue<uint32_t>(head, sections.size());
+        for (const auto &section : sections) {
+            uint64_t size = 0;
+            uint32_t crc = 0;
+            for (const std::string &part : section.second) {
+                size += part.size();
+                crc = crc32c(crc, part.data(), part.size());
+            }
+            if (size > UINT32_MAX)
+                return false;
+            appendValue<uint32_t>(head, section.first);
+            appendValue<uint32_t>(head, (uint32_t)size);
+            appendValue<uint32_t>(head, crc);
+        }
+        appendValue<uint32_t>(head, tableCrc(head.data(), head.size()));
+
+        uint64_t hash = contentHash(head.data() + ISL_HEADER_SIZE, head.size() - ISL_HEADER_SIZE);
+        for (auto &section : sections) {
+            for (std::string &part : section.second) {
+                if (!part.empty())
+                    chunks.push_back(std::move(part));
+            }
+        }
+        memcpy(&chunks[0][8], &hash, sizeof(hash));
+        return true;
+    }
+
+    bool serialize(const TranslationsMap &translMap, std::string &data, const ISLBinOptions &options,
+                   const MessagesMap *messages)
+    {
+        std::vector<std::string> chunks;
+        if (!serialize(translMap, chunks, options, messages))
+            return false;
+        size_t size = 0;
+        for (const std::string &chunk : chunks)
+            size += chunk.size();
+        data.clear();
+        data.reserve(size);
+        for (const std::string &chunk : chunks)
+            data.append(chunk);
+        return true;
+    }
+
+    bool readHeader(const char *data, size_t size, ISLHeader &header)
+    {
+        if (size < ISL_MAGIC_SIZE + 1 || strncmp(data, ISL_MAGIC, ISL_MAGIC_SIZE) != 0)
+            return false;
+        header.version = data[ISL_MAGIC_SIZE];
+        header.flags = 0;
+        header.hash = 0;
+        if (header.version == ISL_VERSION_LEGACY)
+            return true;
+        if (header.version != ISL_VERSION || size < ISL_HEADER_SIZE)
+            return false;
+        memcpy(&header.flags, data + 4, sizeof(header.flags));
+        memcpy(&header.hash, data + 8, sizeof(header.hash));
+        return true;
+    }
+
+    bool readSections(const char *data, size_t size, std::vector<ISLSection> &sections)
+    {
+        // Checks the header and section table, section payloads are not touched
+        const char *it = data + ISL_HEADER_SIZE, *end = data + size;
+        uint32_t count = 0;
+        if (size < ISL_HEADER_SIZE || !readValue<uint32_t>(it, end, count) || (size_t)(end - it) / 12 < count)
+            return false;
+        size_t offset = ISL_HEADER_SIZE + sizeof(uint32_t) + (size_t)count * 12 + sizeof(uint32_t);
+        sections.resize(count);
+        for (ISLSection &section : sections) {
+            readValue<uint32_t>(it, end, section.id);
+            readValue<uint32_t>(it, end, section.size);
+            readValue<uint32_t>(it, end, section.crc);
+            section.offset = offset;
+            offset += section.size;
+        }
+        uint32_t crc = 0;
+        if (!readValue<uint32_t>(it, end, crc) || crc != tableCrc(data, it - data - sizeof(crc)))
+            return false;
+        return true;
+    }
+
+    bool deserialize(const char *data, size_t size, TranslationsMap &translMap, SegmentsMap *segmentsMap,
+                     ISLVariants *variants)
+    {
+        ISLHeader header;
+        if (!readHeader(data, size, header))
+            return false;
+        std::vector<std::pair<tstring, std::vector<tstring>>> order;
+        if (header.version == ISL_VERSION_LEGACY) {
+            const char *it = data + ISL_MAGIC_SIZE + 1;
+            uint16_t count = 0;
+            return readValue<uint16_t>(it, data + size, count) && readRecords(it, data + size, count, translMap, nullptr);
+        }
+
+        std::vector<ISLSection> sections;
+        if (!readSections(data, size, sections))
+            return false;
+        const ISLSection *recs = nullptr, *segs = nullptr, *wide = nullptr, *rules = nullptr, *vars = nullptr, *nspc = nullptr;
+        for (const ISLSection &section : sections) {
+            if (section.offset + section.size > size || crc32c(0, data + section.offset, section.size) != section.crc)
+                return false;
+            if (section.id == ISL_SECTION_RECORDS)
+                recs = &section;
+            else
+            if (section.id == ISL_SECTION_SEGMENTS)
+                segs = &section;
+            else
+            if (section.id == ISL_SECTION_UTF16)
+                wide = &section;
+            else
+            if (section.id == ISL_SECTION_PLURAL_RULES)
+                rules = &section;
+            else
+            if (section.id == ISL_SECTION_VARIANTS)
+                vars = &section;
+            else
+            if (section.id == ISL_SECTION_NAMESPACES)
+                nspc = &section;
+        }
+        if (!recs || ((header.flags & ISL_FLAG_UTF16) && !wide))
+            return false;
+
+        const char *it = nullptr;
+        if (nspc) {
+            // A full read takes everything from the records section, the index is only checked
+            ISLNamespaceIndex index;
+            index.flags = header.flags;
+            index.sections = sections;
+            if (!parseNamespaceIndex(data + nspc->offset, nspc->size, index))
+                return false;
+            for (size_t ns = 0; ns < index.namespaces.size(); ns++) {
+                std::vector<std::pair<size_t, size_t>> ranges;
+                namespaceFileRanges(index, ns, ranges);
+                uint32_t crc = 0;
+                for (const auto &range : ranges)
+                    crc = crc32c(crc, data + range.first, range.second);
+                if (crc != index.namespaces[ns].crc)
+                    return false;
+            }
+        }
+        it = data + recs->offset;
+        const char *utf16 = (header.flags & ISL_FLAG_UTF16) ? data + wide->offset : nullptr;
+        uint16_t count = 0;
+        if (!readValue<uint16_t>(it, it + recs->size, count)
+                || !readRecords(it, data + recs->offset + recs->size, count, translMap, segmentsMap ? &order : nullptr,
+                                utf16, utf16 ? wide->size / 2 : 0))
+            return false;
+        if (variants && rules && vars) {
+            it = data + rules->offset;
+            if (!readPluralRules(it, it + rules->size, *variants))
+                return false;
+            it = data + vars->offset;
+            uint32_t varCount = 0;
+            if (!readValue<uint32_t>(it, it + vars->size, varCount)
+                    || !readVariants(it, data + vars->offset + vars->size, varCount, variants->rules.size(), *variants))
+                return false;
+        }
+        if (!segmentsMap || !segs)
+            return true;
+        it = data + segs->offset;
+        return readSegments(it, it + segs->size, translMap, order, *segmentsMap);
+    }
+
+    bool readNamespaces(const char *data, size_t size, ISLNamespaceIndex &index, ISLVariants *variants)
+    {
+        // Checks the index and the plural rules, namespaces are checked as they are decoded
+        ISLHeader header;
+        if (!readHeader(data, size, header) || header.version != ISL_VERSION || !(header.flags & ISL_FLAG_NAMESPACES)
+                || !readSections(data, size, index.sections))
+            return false;
+        index.flags = header.flags;
+        index.ruleSets = 0;
+        const ISLSection *nspc = nullptr, *rules = nullptr;
+        for (const ISLSection &section : index.sections) {
+            if (section.offset + section.size > size)
+                return false;
+            if (section.id == ISL_SECTION_NAMESPACES)
+                nspc = &section;
+            else
+            if (section.id == ISL_SECTION_PLURAL_RULES)
+                rules = &section;
+        }
+        if (!nspc || crc32c(0, data + nspc->offset, nspc->size) != nspc->crc)
+            return false;
+        if (!parseNamespaceIndex(data + nspc->offset, nspc->size, index))
+            return false;
+        const char *it = nullptr;
+        if (!rules)
+            return true;
+        if (rules->size == 0 || crc32c(0, data + rules->offset, rules->size) != rules->crc)
+            return false;
+        index.ruleSets = (uint8_t)data[rules->offset];
+        it = data + rules->offset;
+        return !variants || readPluralRules(it, it + rules->size, *variants);
+    }
+
+    bool parseNamespaceIndex(const char *data, size_t size, ISLNamespaceIndex &index)
+    {
+        return readNamespaceIndex(data, data + size, index);
+    }
+
+    void namespaceFileRanges(const ISLNamespaceIndex &index, size_t ns, std::vector<std::pair<size_t, size_t>> &ranges)
+    {
+        // Ranges were checked against their sections by parseNamespaceIndex
+        const ISLRange *nsRanges[4];
+        namespaceRanges(index.namespaces[ns], nsRanges);
+        ranges.clear();
+        for (int i = 0; i < 4; i++) {
+            if (nsRanges[i]->size != 0)
+                ranges.push_back(std::make_pair(findSection(index.sections, NAMESPACE_SECTIONS[i])->offset + nsRanges[i]->offset,
+                                                (size_t)nsRanges[i]->size));
+        }
+    }
+
+    int findNamespace(const ISLNamespaceIndex &index, const tstring &stringId)
+    {
+        if (index.nodes.empty())
+            return -1;
+#ifdef _WIN32
+        const std::string id = NS_Utils::TStrToUtf8(stringId);
+#else
+        const std::string &id = stringId;
+#endif
+        const ISLNamespaceNode *node = &index.nodes[0];
+        int ns = (node->ns != ISL_NAMESPACE_NONE) ? node->ns : -1;
+        for (char c : id) {
+            auto first = index.nodes.begin() + node->firstChild, last = first + node->childCount;
+            auto it = std::lower_bound(first, last, (uint8_t)c, [](const ISLNamespaceNode &child, uint8_t byte) {
+                return child.byte < byte;
+            });
+            if (it == last || it->byte != (uint8_t)c)
+                break;
+            node = &*it;
+            if (node->ns != ISL_NAMESPACE_NONE)
+                ns = node->ns;
+        }
+        return ns;
+    }
+
+    bool deserializeNamespace(const char *data, size_t size, const ISLNamespaceIndex &index, size_t ns,
+                              TranslationsMap &translMap, SegmentsMap *segmentsMap, ISLVariants *variants)
+    {
+        if (ns >= index.namespaces.size())
+            return false;
+        const ISLNamespace &space = index.namespaces[ns];
+        for (const ISLSection &section : index.sections) {
+            if (section.offset + section.size > size)
+                return false;
+        }
+        const ISLSection *recs = findSection(index.sections, ISL_SECTION_RECORDS), *wide = findSection(index.sections, ISL_SECTION_UTF16),
+                         *segs = findSection(index.sections, ISL_SECTION_SEGMENTS), *vars = findSection(index.sections, ISL_SECTION_VARIANTS);
+        if (!recs || ((index.flags & ISL_FLAG_UTF16) && !wide))
+            return false;
+
+        // Only the ranges of this namespace are read and checked
+        std::vector<std::pair<size_t, size_t>> ranges;
+        namespaceFileRanges(index, ns, ranges);
+        uint32_t crc = 0;
+        for (const auto &range : ranges)
+            crc = crc32c(crc, data + range.first, range.second);
+        if (crc != space.crc)
+            return false;
+
+        std::vector<std::pair<tstring, std::vector<tstring>>> order;
+        const char *it = data + recs->offset + space.records.offset, *end = it + space.records.size;
+        const char *utf16 = (index.flags & ISL_FLAG_UTF16) ? data + wide->offset : nullptr;
+        if (!readRecords(it, end, space.idCount, translMap, segmentsMap ? &order : nullptr, utf16, utf16 ? wide->size / 2 : 0)
+                || it != end)
+            return false;
+        if (variants && space.variants.size != 0) {
+            it = data + vars->offset + space.variants.offset;
+            if (!readVariants(it, it + space.variants.size, space.variantCount, index.ruleSets, *variants))
+                return false;
+        }
+        if (!segmentsMap || space.segments.size == 0)
+            return true;
+        it = data + segs->offset + space.segments.offset;
+        return readSegments(it, it + space.segments.size, translMap, order, *segmentsMap);
+    }
+
+    bool verify(size_t size, const std::function<size_t(size_t, char*, size_t)> &read, tstring &error)
+    {
+        // Checks header, section table, content hash, section and namespace CRCs, reading each
+        // payload byte once in file order
+        std::string head(ISL_HEADER_SIZE + sizeof(uint32_t), '\0');
+        size_t n = read(0, &head[0], head.size());
+        ISLHeader header;
+        if (!readHeader(head.data(), n, header)) {
+            error = _T("not a BIN file or unsupported version");
+            return false;
+        }
+        if (header.version == ISL_VERSION_LEGACY) {
+            error = _T("legacy format without checksums");
+            return false;
+        }
+        if (n != head.size()) {
+            error = _T("truncated header");
+            return false;
+        }
+
+        uint32_t count = 0;
+        memcpy(&count, &head[ISL_HEADER_SIZE], sizeof(count));
+        if (count > (size - head.size()) / 12) {
+            error = _T("corrupted section table");
+            return false;
+        }
+        size_t tableSize = (size_t)count * 12 + sizeof(uint32_t);
+        head.resize(head.size() + tableSize);
+        std::vector<ISLSection> sections;
+        if (read(head.size() - tableSize, &head[head.size() - tableSize], tableSize) != tableSize
+                || !readSections(head.data(), head.size(), sections)) {
+            error = _T("corrupted section table");
+            return false;
+        }
+
+        // The content hash is derived from the section table, whose CRCs cover the payloads
+        if (contentHash(head.data() + ISL_HEADER_SIZE, head.size() - ISL_HEADER_SIZE) != header.hash) {
+            error = _T("content hash mismatch");
+            return false;
+        }
+
+        // Only the small namespace index is read ahead, its ranges are checked in the main pass
+        ISLNamespaceIndex index;
+        std::vector<NamespaceRange> ranges;
+        if (header.flags & ISL_FLAG_NAMESPACES) {
+            index.flags = header.flags;
+            index.sections = sections;
+            const ISLSection *nspc = findSection(sections, ISL_SECTION_NAMESPACES);
+            std::string payload(nspc ? nspc->size : 0, '\0');
+            if (!nspc || read(nspc->offset, &payload[0], payload.size()) != payload.size()
+                    || !parseNamespaceIndex(payload.data(), payload.size(), index)) {
+                error = _T("corrupted namespace index");
+                return false;
+            }
+            std::vector<std::pair<size_t, size_t>> nsRanges;
+            for (size_t ns = 0; ns < index.namespaces.size(); ns++) {
+                namespaceFileRanges(index, ns, nsRanges);
+                for (const auto &range : nsRanges)
+                    ranges.push_back(NamespaceRange{range.first, range.second, ns, 0});
+            }
+        }
+        std::vector<size_t> order(ranges.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&ranges](size_t a, size_t b) {
+            return ranges[a].offset < ranges[b].offset;
+        });
+
+        // Namespace ranges are checksummed as the sections stream past and combined in index order
+        std::vector<char> buf(1 << 20);
+        std::vector<size_t> active;
+        size_t next = 0, pos = head.size();
+        for (const ISLSection &section : sections) {
+            tstring name;
+            for (int i = 0; i < 4; i++)
+                name.push_back((tchar)((section.id >> (8 * i)) & 0xff));
+            uint32_t crc = 0;
+            size_t left = section.size;
+            while (left != 0) {
+                size_t chunk = std::min(left, buf.size());
+                if (read(pos, buf.data(), chunk) != chunk) {
+                    error = _T("section ") + name + _T(": truncated");
+                    return false;
+                }
+                crc = crc32c(crc, buf.data(), chunk);
+                while (next < order.size() && ranges[order[next]].offset < pos + chunk)
+                    active.push_back(order[next++]);
+                for (size_t i = 0; i < active.size();) {
+                    NamespaceRange &range = ranges[active[i]];
+                    size_t from = std::max(range.offset, pos), to = std::min(range.offset + range.size, pos + chunk);
+                    if (from < to)
+                        range.crc = crc32c(range.crc, buf.data() + (from - pos), to - from);
+                    if (range.offset + range.size <= pos + chunk) {
+                        active[i] = active.back();
+                        active.pop_back();
+                    } else {
+                        i++;
+                    }
+                }
+                pos += chunk;
+                left -= chunk;
+            }
+            if (crc != section.crc) {
+                error = _T("section ") + name + _T(": checksum mismatch");
+                return false;
+            }
+        }
+        if (pos != size) {
+            error = _T("unexpected data after the last section");
+            return false;
+        }
+
+        std::vector<uint32_t> nsCrcs(index.namespaces.size(), 0);
+        for (const NamespaceRange &range : ranges)
+            nsCrcs[range.ns] = crc32cCombine(nsCrcs[range.ns], range.crc, range.size);
+        for (size_t ns = 0; ns < index.namespaces.size(); ns++) {
+            if (nsCrcs[ns] != index.namespaces[ns].crc) {
+                error = _T("namespace '") + index.namespaces[ns].prefix + _T("': checksum mismatch");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool splitPlaceholders(const tstring &value, std::vector<ISLSegment> &segments, std::vector<tstring> &names)
+    {
+        return splitValue(value, segments, names);
+    }
+
+    bool encodeMessage(const ISLMessage &message, std::string &data)
+    {
+        if (message.nodes.size() > UINT16_MAX)
+            return false;
+        appendValue<uint16_t>(data, message.nodes.size());
+        for (const ISLVariantNode &node : message.nodes) {
+            appendValue<uint8_t>(data, node.kind);
+            std::string text = NS_Utils::TStrToUtf8(node.text);
+            switch (node.kind) {
+            case ISL_VARIANT_TEXT:
+                if (!appendString<uint16_t>(data, text))
+                    return false;
+                break;
+            case ISL_VARIANT_INDEX:
+                appendValue<uint8_t>(data, node.value);
+                break;
+            case ISL_VARIANT_NAME:
+                if (!appendString<uint8_t>(data, text))
+                    return false;
+                break;
+            case ISL_VARIANT_PLURAL:
+            case ISL_VARIANT_SELECT:
+                if (!appendString<uint8_t>(data, text))
+                    return false;
+                appendValue<uint16_t>(data, node.size);
+                break;
+            case ISL_VARIANT_CASE:
+                appendValue<uint8_t>(data, node.category);
+                appendValue<uint32_t>(data, node.value);
+                if (!appendString<uint8_t>(data, text))
+                    return false;
+                appendValue<uint16_t>(data, node.size);
+                break;
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool checkPlaceholders(const TranslationsMap &translMap, const tstring &sourceLocale, tstring &error)
+    {
+        auto placeholders = [](const tstring &value, bool &fits) {
+            std::vector<ISLSegment> segments;
+            std::vector<tstring> names;
+            fits = splitValue(value, segments, names);
+            std::set<tstring> result;
+            for (const ISLSegment &seg : segments) {
+                if (seg.kind != ISL_SEGMENT_LITERAL)
+                    result.insert(value.substr(seg.offset, seg.length));
+            }
+            return result;
+        };
+        auto join = [](const std::set<tstring> &set) {
+            tstring out;
+            for (const tstring &str : set)
+                out.append(out.empty() ? str : _T(" ") + str);
+            return out.empty() ? tstring(_T("none")) : out;
+        };
+
+        std::set<tstring> ids;
+        for (auto it = translMap.cbegin(); it != translMap.cend(); ++it)
+            ids.insert(it->first);
+        bool valid = true;
+        for (const tstring &id : ids) {
+            const LocaleMap &localeMap = translMap.at(id);
+            auto src_it = localeMap.find(sourceLocale);
+            if (src_it == localeMap.end())
+                continue;
+            bool fits = true;
+            std::set<tstring> expected = placeholders(src_it->second, fits);
+            std::set<tstring> locales;
+            for (auto loc_it = localeMap.cbegin(); loc_it != localeMap.cend(); ++loc_it)
+                locales.insert(loc_it->first);
+            for (const tstring &locale : locales) {
+                std::set<tstring> found = placeholders(localeMap.at(locale), fits);
+                if (!fits) {
+                    error.append(_T("Value too long for placeholders in ") + locale + _T(".") + id + _T("\n"));
+                    valid = false;
+                } else
+                if (found != expected) {
+                    error.append(_T("Placeholder mismatch in ") + locale + _T(".") + id + _T(": expected ")
+                                 + join(expected) + _T(", found ") + join(found) + _T("\n"));
+                    valid = false;
+                }
+            }
+        }
+        return valid;
+    }
+}
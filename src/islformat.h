@@ -0,0 +1,217 @@
+#ifndef ISLFORMAT_H
+#define ISLFORMAT_H
+
+#include <functional>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#ifdef _WIN32
+# include <tchar.h>
+# define tchar wchar_t
+  typedef std::wstring tstring;
+#else
+# define _T(str) str
+# define tchar char
+  typedef std::string tstring;
+#endif
+
+using std::unordered_map;
+
+typedef unordered_map<tstring, tstring> LocaleMap;
+typedef unordered_map<tstring, LocaleMap> TranslationsMap;
+
+/*
+ * BIN layout, version 3:
+ *   char     magic[3]   "ISL"
+ *   uint8_t  version    0 for legacy files, which hold a bare records section after the magic
+ *   uint32_t flags
+ *   uint64_t hash       FNV-1a 64 of the section table below, its CRCs stand for the payloads
+ *   uint32_t sectionCount
+ *   sectionCount x { uint32_t id, uint32_t size, uint32_t crc32c }
+ *   uint32_t crc32c     of all bytes above except the hash
+ *   section payloads, back to back in table order
+ *
+ * Records section (ISL_SECTION_RECORDS):
+ *   uint16_t idCount
+ *   idCount x { uint8_t idLen, id, uint16_t localeCount,
+ *               localeCount x { uint8_t localeLen, locale, uint16_t valueLen, value } }
+ * IDs and locales are sorted by their UTF-8 bytes, so equal input gives equal output. IDs from
+ * a usage profile (ISLBinOptions::hotIds) come first in profile order, so they share pages.
+ * With ISL_FLAG_UTF16 each value is stored as { uint32_t offset, uint16_t length } instead,
+ * both in UTF-16 code units of the UTF-16 section.
+ *
+ * UTF-16 section (ISL_SECTION_UTF16, ISL_FLAG_UTF16), always first in the table so it starts
+ * at a 4-byte aligned file offset:
+ *   UTF-16LE values, each followed by a 0 unit, so they can be used in place as wide strings
+ *
+ * Segments section (ISL_SECTION_SEGMENTS, ISL_FLAG_SEGMENTS), in the order of the records:
+ *   idCount x { uint8_t nameCount, nameCount x { uint8_t nameLen, name },
+ *               localeCount x { uint8_t segCount, segCount x { uint8_t kind, uint8_t arg,
+ *                                                               uint16_t offset, uint16_t length } } }
+ * Segments tile the UTF-8 value. Placeholders are "%N" (arg N) and "{name}" (arg is the
+ * index of name in the ID's name table), everything else is a literal.
+ *
+ * Plural rules section (ISL_SECTION_PLURAL_RULES, ISL_FLAG_VARIANTS), see islplural.h:
+ *   uint8_t setCount, setCount x { uint8_t nameLen, name, uint8_t ruleCount,
+ *     ruleCount x { uint8_t category, uint8_t clauseCount, clauseCount x { uint8_t termCount,
+ *       termCount x { uint32_t mod, uint8_t negate, uint8_t rangeCount, rangeCount x { uint32_t lo, hi } } } } }
+ *
+ * Variants section (ISL_SECTION_VARIANTS, ISL_FLAG_VARIANTS), only values with plural or select:
+ *   uint32_t count, count x { uint8_t idLen, id, uint8_t localeLen, locale, uint8_t ruleSet,
+ *                             uint16_t nodeCount, nodes in pre-order }
+ *   node: uint8_t kind, then TEXT: uint16_t len, text | INDEX: uint8_t arg | NAME: uint8_t len, name
+ *         | PLURAL, SELECT: uint8_t len, name, uint16_t size
+ *         | CASE: uint8_t category, uint32_t value, uint8_t keyLen, key, uint16_t size
+ *
+ * Namespaces section (ISL_SECTION_NAMESPACES, ISL_FLAG_NAMESPACES), an index for loading IDs
+ * by prefix on first use:
+ *   uint16_t nsCount, nsCount x { uint8_t prefixLen, prefix, uint16_t idCount, uint32_t variantCount,
+ *                                 uint32_t crc32c, 4 x { uint32_t offset, uint32_t size } }
+ *   uint32_t nodeCount, nodeCount x { uint8_t byte, uint16_t childCount, uint32_t firstChild, uint16_t ns }
+ * The namespace of an ID is its prefix up to and including the first '_', or "" if it has none.
+ * Records are grouped by namespace (sorted by prefix, profile IDs first within each), so every
+ * namespace covers one byte range of the records, UTF-16, segments and variants payloads, in
+ * that order; the crc32c covers these ranges. The trie maps prefix bytes to namespaces: node 0
+ * is the root, children are contiguous and sorted by byte, ns is ISL_NAMESPACE_NONE for nodes
+ * that end no prefix. An ID belongs to the namespace of the deepest node on its path.
+ */
+
+#define ISL_MAGIC           "ISL"
+#define ISL_MAGIC_SIZE      3
+#define ISL_VERSION_LEGACY  0
+#define ISL_VERSION         3
+#define ISL_HEADER_SIZE     16
+
+#define ISL_FOURCC(a,b,c,d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define ISL_SECTION_RECORDS      ISL_FOURCC('R','E','C','S')
+#define ISL_SECTION_SEGMENTS     ISL_FOURCC('S','E','G','S')
+#define ISL_SECTION_UTF16        ISL_FOURCC('U','1','6','V')
+#define ISL_SECTION_PLURAL_RULES ISL_FOURCC('P','L','R','L')
+#define ISL_SECTION_VARIANTS     ISL_FOURCC('V','A','R','S')
+#define ISL_SECTION_NAMESPACES   ISL_FOURCC('N','S','P','C')
+
+#define ISL_FLAG_SEGMENTS   0x1
+#define ISL_FLAG_UTF16      0x2
+#define ISL_FLAG_VARIANTS   0x4
+#define ISL_FLAG_NAMESPACES 0x8
+
+#define ISL_NAMESPACE_SEPARATOR '_'
+#define ISL_NAMESPACE_NONE  0xffff
+
+#define ISL_SEGMENT_LITERAL 0
+#define ISL_SEGMENT_INDEX   1
+#define ISL_SEGMENT_NAME    2
+
+struct ISLHeader
+{
+    uint8_t  version;
+    uint32_t flags;
+    uint64_t hash;
+};
+
+struct ISLSection
+{
+    uint32_t id;
+    uint32_t size;
+    uint32_t crc;
+    size_t   offset;
+};
+
+struct ISLSegment
+{
+    uint8_t  kind;
+    uint8_t  arg;
+    uint16_t offset;
+    uint16_t length;
+};
+
+typedef unordered_map<tstring, std::vector<ISLSegment>> LocaleSegmentMap;
+
+struct ISLSegmentTable
+{
+    std::vector<tstring> names;
+    LocaleSegmentMap     locales;
+};
+
+typedef unordered_map<tstring, ISLSegmentTable> SegmentsMap;
+
+struct ISLRange
+{
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct ISLNamespace
+{
+    tstring  prefix;
+    uint16_t idCount;
+    uint32_t variantCount;
+    uint32_t crc;
+    ISLRange records;
+    ISLRange utf16;
+    ISLRange segments;
+    ISLRange variants;
+};
+
+struct ISLNamespaceNode
+{
+    uint8_t  byte;
+    uint16_t childCount;
+    uint32_t firstChild;
+    uint16_t ns;
+};
+
+struct ISLNamespaceIndex
+{
+    uint32_t flags;
+    uint8_t  ruleSets;
+    std::vector<ISLSection>       sections;
+    std::vector<ISLNamespace>     namespaces;
+    std::vector<ISLNamespaceNode> nodes;
+};
+
+struct ISLMessage;
+struct ISLVariants;
+class ThreadPool;
+
+// Plural and select messages by ID and locale, their nodes encoded as in the variants section
+typedef unordered_map<tstring, unordered_map<tstring, std::string>> MessagesMap;
+
+struct ISLBinOptions
+{
+    ISLBinOptions();
+
+    bool    segments;
+    bool    utf16;
+    bool    namespaces;
+    tstring sourceLocale;
+    std::vector<tstring> locales; // locales kept while parsing ('*' and '?' allowed), empty keeps all
+    std::vector<tstring> hotIds;  // IDs placed before all others, hottest first
+    ThreadPool *pool;             // encodes large bundles in shards, nullptr encodes on the calling thread
+};
+
+namespace NS_Format
+{
+uint64_t contentHash(const char *data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL);
+bool serialize(const TranslationsMap &translMap, std::string &data, const ISLBinOptions &options = ISLBinOptions(),
+               const MessagesMap *messages = nullptr);
+bool serialize(const TranslationsMap &translMap, std::vector<std::string> &chunks, const ISLBinOptions &options = ISLBinOptions(),
+               const MessagesMap *messages = nullptr);
+bool deserialize(const char *data, size_t size, TranslationsMap &translMap, SegmentsMap *segmentsMap = nullptr,
+                 ISLVariants *variants = nullptr);
+bool readHeader(const char *data, size_t size, ISLHeader &header);
+bool verify(size_t size, const std::function<size_t(size_t offset, char *buf, size_t length)> &read, tstring &error);
+bool readSections(const char *data, size_t size, std::vector<ISLSection> &sections);
+bool readNamespaces(const char *data, size_t size, ISLNamespaceIndex &index, ISLVariants *variants = nullptr);
+bool parseNamespaceIndex(const char *data, size_t size, ISLNamespaceIndex &index);
+void namespaceFileRanges(const ISLNamespaceIndex &index, size_t ns, std::vector<std::pair<size_t, size_t>> &ranges);
+int findNamespace(const ISLNamespaceIndex &index, const tstring &stringId);
+bool deserializeNamespace(const char *data, size_t size, const ISLNamespaceIndex &index, size_t ns,
+                          TranslationsMap &translMap, SegmentsMap *segmentsMap = nullptr, ISLVariants *variants = nullptr);
+bool splitPlaceholders(const tstring &value, std::vector<ISLSegment> &segments, std::vector<tstring> &names);
+bool encodeMessage(const ISLMessage &message, std::string &data);
+bool checkPlaceholders(const TranslationsMap &translMap, const tstring &sourceLocale, tstring &error);
+}
+
+#endif // ISLFORMAT_H
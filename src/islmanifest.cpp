@@ -0,0 +1,213 @@
+#include "islmanifest.h"
+#include "threadpool.h"
+#include "utils.h"
+#include <memory>
+#include <unordered_set>
+
+
+static bool isAbsolutePath(const tstring &path)
+{
+#ifdef _WIN32
+    return (!path.empty() && (path[0] == L'/' || path[0] == L'\\')) || (path.length() > 1 && path[1] == L':');
+#else
+    return !path.empty() && path[0] == '/';
+#endif
+}
+
+static tstring normalizedPath(tstring path)
+{
+    // Lexical only, so that "out/a.bin" and "./out//a.bin" are seen as the same output
+#ifdef _WIN32
+    path = NS_File::fromNativeSeparators(path);
+#endif
+    std::vector<tstring> parts;
+    size_t pos = 0;
+    while (pos <= path.length()) {
+        size_t end = path.find(_T('/'), pos);
+        if (end == tstring::npos)
+            end = path.length();
+        tstring part = path.substr(pos, end - pos);
+        pos = end + 1;
+        if (part.empty() || part == _T("."))
+            continue;
+        if (part == _T("..") && !parts.empty() && parts.back() != _T("..")) {
+            parts.pop_back();
+            continue;
+        }
+        parts.push_back(part);
+    }
+    tstring result = (!path.empty() && path[0] == _T('/')) ? _T("/") : _T("");
+    for (size_t i = 0; i < parts.size(); i++)
+        result += (i == 0 ? _T("") : _T("/")) + parts[i];
+    return result;
+}
+
+ISLManifest::ISLManifest()
+{
+
+}
+
+ISLManifest::~ISLManifest()
+{
+
+}
+
+bool ISLManifest::load(const tstring &manifestPath, tstring &error)
+{
+    targetList.clear();
+    std::string data;
+    if (!NS_File::readFile(manifestPath, data)) {
+        error = _T("cannot read file ") + manifestPath;
+        return false;
+    }
+    tstring text = NS_Utils::Utf8ToTStr(data);
+    tstring baseDir = NS_File::parentPath(manifestPath);
+    if (!baseDir.empty() && baseDir.back() != _T('/'))
+        baseDir.push_back(_T('/'));
+
+    std::unordered_set<tstring> outputs;
+    size_t lineNum = 0, pos = 0;
+    while (pos < text.length()) {
+        size_t end = text.find(_T('\n'), pos);
+        if (end == tstring::npos)
+            end = text.length();
+        tstring line = text.substr(pos, end - pos);
+        pos = end + 1;
+        lineNum++;
+
+        std::vector<tstring> tokens;
+        if (!NS_Utils::SplitLine(line, tokens)) {
+            error = manifestPath + _T(": unterminated quote in line ") + to_tstring(lineNum);
+            return false;
+        }
+        if (tokens.empty() || tokens[0][0] == _T(';'))
+            continue;
+        if (tokens.size() < 3 || tokens[1] != _T("=")) {
+            error = manifestPath + _T(": expected '<output> = <input> ...' in line ") + to_tstring(lineNum);
+            return false;
+        }
+
+        ISLTarget target;
+        target.output = isAbsolutePath(tokens[0]) ? tokens[0] : baseDir + tokens[0];
+        if (!outputs.insert(normalizedPath(target.output)).second) {
+            // Two targets would write the same file concurrently in build()
+            error = manifestPath + _T(": duplicate output ") + tokens[0] + _T(" in line ") + to_tstring(lineNum);
+            return false;
+        }
+        for (size_t i = 2; i < tokens.size(); i++) {
+            tstring input = isAbsolutePath(tokens[i]) ? tokens[i] : baseDir + tokens[i];
+            if (NS_File::fileExists(input)) {
+                target.inputs.push_back(input);
+                continue;
+            }
+            // Sorted, so the merge order and the winner of duplicate values do not depend on the file system
+            std::vector<tstring> files = NS_File::findFiles(input, _T(".isl"), false, std::vector<tstring>(),
+                                                            std::vector<tstring>());
+            if (files.empty()) {
+                error = manifestPath + _T(": input not found: ") + input;
+                return false;
+            }
+            target.inputs.insert(target.inputs.end(), files.begin(), files.end());
+        }
+        targetList.push_back(target);
+    }
+
+    if (targetList.empty()) {
+        error = manifestPath + _T(": manifest does not contain targets");
+        return false;
+    }
+    return true;
+}
+
+bool ISLManifest::build(unsigned jobs, tstring &report)
+{
+    // Every distinct input is parsed exactly once and shared by all targets
+    std::vector<tstring> inputs;
+    std::unordered_map<tstring, size_t> inputIndex;
+    for (const ISLTarget &target : targetList) {
+        for (const tstring &input : target.inputs) {
+            if (inputIndex.find(input) == inputIndex.end()) {
+                inputIndex[input] = inputs.size();
+                inputs.push_back(input);
+            }
+        }
+    }
+
+    std::vector<ISLParser> parsers(inputs.size());
+    std::vector<tstring> parseErrors(inputs.size());
+    std::unique_ptr<bool[]> parsed(new bool[inputs.size()]);
+    std::vector<tstring> results(targetList.size());
+    std::unique_ptr<bool[]> built(new bool[targetList.size()]);
+
+    // Inputs are loaded in one batch, each buffer is released once it is parsed
+    std::vector<std::string> contents;
+    std::vector<bool> loaded;
+    NS_File::readFiles(inputs, contents, loaded);
+    ThreadPool pool(jobs);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        pool.submit([&, i]() {
+            parsers[i].setBinOptions(binOptions);
+            if (!loaded[i]) {
+                parsed[i] = false;
+                parseErrors[i] = _T("cannot read file ") + inputs[i];
+                return;
+            }
+            parsed[i] = parsers[i].parseData(contents[i], parseErrors[i], inputs[i]);
+            std::string().swap(contents[i]);
+        });
+    }
+    pool.wait();
+
+    for (size_t i = 0; i < targetList.size(); i++) {
+        pool.submit([&, i]() {
+            const ISLTarget &target = targetList[i];
+            built[i] = false;
+            TranslationsMap translMap;
+            MessagesMap messages;
+            for (const tstring &input : target.inputs) {
+                size_t index = inputIndex.at(input);
+                if (!parsed[index]) {
+                    results[i] = parseErrors[index];
+                    return;
+                }
+                ISLParser::mergeTranslations(translMap, messages, parsers[index].translationsMap(),
+                                             parsers[index].messagesMap());
+            }
+            if (translMap.empty()) {
+                results[i] = _T("translations map is empty!");
+                return;
+            }
+            if (binOptions.segments && !NS_Format::checkPlaceholders(translMap, binOptions.sourceLocale, results[i])) {
+                results[i].insert(0, _T("\n"));
+                return;
+            }
+            if (!NS_File::writeBinFile(target.output, translMap, binOptions, &messages)) {
+                results[i] = _T("cannot write file ") + target.output;
+                return;
+            }
+            built[i] = true;
+        });
+    }
+    pool.wait();
+
+    bool success = true;
+    for (size_t i = 0; i < targetList.size(); i++) {
+        if (built[i]) {
+            report.append(_T("[OK] Conversion succeeded: ") + targetList[i].output + _T("\n"));
+        } else {
+            report.append(_T("[ERROR] Conversion failed: ") + targetList[i].output + _T(": ") + results[i] + _T("\n"));
+            success = false;
+        }
+    }
+    return success;
+}
+
+const std::vector<ISLTarget>& ISLManifest::targets() const
+{
+    return targetList;
+}
+
+void ISLManifest::setBinOptions(const ISLBinOptions &options)
+{
+    binOptions = options;
+}
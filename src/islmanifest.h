@@ -0,0 +1,29 @@
+#ifndef ISLMANIFEST_H
+#define ISLMANIFEST_H
+
+#include "islparser.h"
+
+
+struct ISLTarget
+{
+    tstring output;
+    std::vector<tstring> inputs;
+};
+
+class ISLManifest
+{
+public:
+    ISLManifest();
+    ~ISLManifest();
+
+    bool load(const tstring &manifestPath, tstring &error);
+    bool build(unsigned jobs, tstring &report);
+    const std::vector<ISLTarget>& targets() const;
+    void setBinOptions(const ISLBinOptions &options);
+
+private:
+    std::vector<ISLTarget> targetList;
+    ISLBinOptions binOptions;
+};
+
+#endif // ISLMANIFEST_H
@@ -1,4 +1,7 @@
 #include "islparser.h"
+#include "islplural.h"
+#include <algorithm>
+#include <map>
 #include <sstream>
 #ifdef _WIN32
 # include "utils.h"
@@ -16,6 +19,10 @@
 # define tistringstream std::istringstream
 #endif
 
+#define MAX_PARSE_ERRORS  100
+#define MAX_ERROR_EXCERPT 40
+#define VERIFY_BATCH_FILES 64
+
 
 static bool isSeparator(tchar c)
 {
@@ -47,7 +54,8 @@ static std::string WStrToUtf8(const std::wstring &str)
 #endif
 
 ISLParser::ISLParser() :
-    is_translations_valid(false)
+    is_translations_valid(false),
+    errorCount(0)
 {
 
 }
@@ -57,25 +65,58 @@ ISLParser::~ISLParser()
 
 }
 
+static bool isBinPath(const tstring &filePath)
+{
+    return filePath.length() > 4 && filePath.compare(filePath.length() - 4, 4, _T(".bin")) == 0;
+}
+
 void ISLParser::verify(const std::vector<tstring> &islFilePaths, tstring &error)
 {
-    for (const tstring &filePath : islFilePaths) {
+    // ISL files are loaded a batch at a time, BIN files are streamed by verifyBinFile
+    std::vector<std::string> contents;
+    std::vector<bool> loaded;
+    std::vector<size_t> slots(islFilePaths.size(), 0);
+    for (size_t i = 0; i < islFilePaths.size(); i++) {
+        const tstring &filePath = islFilePaths[i];
+        if (i % VERIFY_BATCH_FILES == 0) {
+            std::vector<tstring> batch;
+            for (size_t j = i; j < std::min<size_t>(i + VERIFY_BATCH_FILES, islFilePaths.size()); j++) {
+                if (!isBinPath(islFilePaths[j])) {
+                    slots[j] = batch.size();
+                    batch.push_back(islFilePaths[j]);
+                }
+            }
+            NS_File::readFiles(batch, contents, loaded);
+        }
         error.append(_T("\nFile verification: ") + filePath + _T("\n"));
         error.append(_T("============================\n"));
+        if (isBinPath(filePath)) {
+            tstring binError;
+            if (!NS_File::verifyBinFile(filePath, binError))
+                error.append(_T("Error: ") + binError + _T("\n"));
+            else
+                error.append(_T("Status: ok\n"));
+            continue;
+        }
+        // Every file is checked on its own, placeholders included
         is_translations_valid = false;
+        translMap.clear();
+        messages.clear();
         if (!translations.empty())
             translations.clear();
-        std::string tr;
-        if (!NS_File::readFile(filePath, tr)) {
+        sources.assign(1, std::make_pair(0, filePath));
+        std::string &content = contents[slots[i]];
+        if (!loaded[slots[i]]) {
             error.append(_T("Error: cannot read file!\n"));
             continue;
         }
-        if (!tr.empty()) {
+        if (!content.empty()) {
 #ifdef _WIN32
-            translations = Utf8ToWStr(tr);
+            translations = Utf8ToWStr(content);
 #else
-            translations = tr;
+            translations.swap(content);
 #endif
+            std::string().swap(content);
         }
 
         if (translations.empty()) {
@@ -85,13 +126,15 @@ void ISLParser::verify(const std::vector<tstring> &islFilePaths, tstring &error)
 
         parseTranslations();
         if (!is_translations_valid) {
-            error.append(_T("Error: cannot parse translations, error in string:\n") + error_substr + _T(" <---\n"));
+            error.append(_T("Error: cannot parse translations:\n") + errorReport() + _T("\n"));
             continue;
         }
         if (translMap.empty()) {
             error.append(_T("Warning: translations map is empty!\n"));
             continue;
         }
+        if (binOptions.segments && !NS_Format::checkPlaceholders(translMap, binOptions.sourceLocale, error))
+            continue;
         error.append(_T("Status: ok\n"));
     }
 }
@@ -101,19 +144,24 @@ bool ISLParser::translationToBin(const std::vector<tstring> &islFilePaths, const
     is_translations_valid = false;
     if (!translations.empty())
         translations.clear();
-    for (const tstring &filePath : islFilePaths) {
-        std::string tr;
-        if (!NS_File::readFile(filePath, tr)) {
-            error = _T("cannot read file ") + filePath;
+    sources.clear();
+    std::vector<std::string> contents;
+    std::vector<bool> loaded;
+    NS_File::readFiles(islFilePaths, contents, loaded);
+    for (size_t i = 0; i < islFilePaths.size(); i++) {
+        if (!loaded[i]) {
+            error = _T("cannot read file ") + islFilePaths[i];
             return false;
         }
-        if (!tr.empty()) {
+        if (!contents[i].empty()) {
+            sources.push_back(std::make_pair(translations.length(), islFilePaths[i]));
 #ifdef _WIN32
-            translations.append(Utf8ToWStr(tr));
+            translations.append(Utf8ToWStr(contents[i]));
 #else
-            translations.append(tr);
+            translations.append(contents[i]);
 #endif
             translations.push_back('\n');
+            std::string().swap(contents[i]);
         }
     }
 
@@ -124,7 +172,7 @@ bool ISLParser::translationToBin(const std::vector<tstring> &islFilePaths, const
 
     parseTranslations();
     if (!is_translations_valid) {
-        error = _T("cannot parse translations, error in string: ") + error_substr + _T(" <---");
+        error = _T("cannot parse translations:\n") + errorReport();
         return false;
     }
 
@@ -132,7 +180,9 @@ bool ISLParser::translationToBin(const std::vector<tstring> &islFilePaths, const
         error = _T("translations map is empty!");
         return false;
     }
-    if (!NS_File::writeBinFile(binFilePath, translMap)) {
+    if (binOptions.segments && !NS_Format::checkPlaceholders(translMap, binOptions.sourceLocale, error))
+        return false;
+    if (!NS_File::writeBinFile(binFilePath, translMap, binOptions, &messages)) {
         error = _T("cannot write file ") + binFilePath;
         return false;
     }
@@ -145,9 +195,18 @@ bool ISLParser::binToTranslation(const tstring &binFilePath, const tstring &islF
     std::unordered_map<tstring, LocaleMap> translMap;
     if (!NS_File::readBinFile(binFilePath, translMap))
         return false;
-    for (auto it = translMap.cbegin(); it != translMap.cend(); ++it) {
+    formatTranslations(translMap, out);
+    return NS_File::writeFile(islFilePath, out);
+}
+
+void ISLParser::formatTranslations(const TranslationsMap &translMap, std::string &out)
+{
+    std::map<tstring, std::map<tstring, tstring>> sortedMap;
+    for (auto it = translMap.cbegin(); it != translMap.cend(); ++it)
+        sortedMap[it->first].insert(it->second.cbegin(), it->second.cend());
+    for (auto it = sortedMap.cbegin(); it != sortedMap.cend(); ++it) {
         tstring key = it->first;
-        const LocaleMap &localeMap = it->second;
+        const std::map<tstring, tstring> &localeMap = it->second;
         for (auto it = localeMap.cbegin(); it != localeMap.cend(); ++it) {
             std::string val;
 #ifdef _WIN32
@@ -173,7 +232,179 @@ bool ISLParser::binToTranslation(const tstring &binFilePath, const tstring &islF
         }
         out.append("\n");
     }
-    return NS_File::writeFile(islFilePath, out);
+}
+
+bool ISLParser::parseFile(const tstring &islFilePath, tstring &error)
+{
+    std::string tr;
+    if (!NS_File::readFile(islFilePath, tr)) {
+        translMap.clear();
+        messages.clear();
+        error = _T("cannot read file ") + islFilePath;
+        return false;
+    }
+    return parseData(tr, error, islFilePath);
+}
+
+bool ISLParser::parseData(const std::string &data, tstring &error, const tstring &sourceName)
+{
+    is_translations_valid = false;
+    translMap.clear();
+    messages.clear();
+    translations.clear();
+    sources.assign(1, std::make_pair(0, sourceName));
+    if (!data.empty()) {
+#ifdef _WIN32
+        translations = Utf8ToWStr(data);
+#else
+        translations = data;
+#endif
+    }
+
+    if (translations.empty()) {
+        error = sourceName.empty() ? _T("translations is empty!") : sourceName + _T(": translations is empty!");
+        return false;
+    }
+
+    parseTranslations();
+    if (!is_translations_valid) {
+        error = _T("cannot parse translations:\n") + errorReport();
+        return false;
+    }
+    return true;
+}
+
+const TranslationsMap& ISLParser::translationsMap() const
+{
+    return translMap;
+}
+
+TranslationsMap ISLParser::takeTranslationsMap()
+{
+    TranslationsMap result;
+    result.swap(translMap);
+    return result;
+}
+
+const MessagesMap& ISLParser::messagesMap() const
+{
+    return messages;
+}
+
+MessagesMap ISLParser::takeMessagesMap()
+{
+    MessagesMap result;
+    result.swap(messages);
+    return result;
+}
+
+void ISLParser::setBinOptions(const ISLBinOptions &options)
+{
+    binOptions = options;
+}
+
+bool ISLParser::isLocaleWanted(const tchar *locale, size_t length) const
+{
+    if (binOptions.locales.empty())
+        return true;
+    for (const tstring &pattern : binOptions.locales) {
+        if (NS_Utils::matchGlob(pattern.c_str(), locale, locale + length))
+            return true;
+    }
+    return false;
+}
+
+size_t ISLParser::addError(size_t offset, const tchar *message)
+{
+    // Only the first errors are kept, the rest is counted
+    if (parseErrors.size() < MAX_PARSE_ERRORS) {
+        ParseError err;
+        err.offset = offset;
+        err.message = message;
+        parseErrors.push_back(err);
+    }
+    errorCount++;
+    size_t end = translations.find_first_of(_T('\n'), offset);
+    return (end == tstring::npos) ? translations.length() : end;
+}
+
+tstring ISLParser::errorReport()
+{
+    // Line starts are indexed only once there is something to report
+    if (lineOffsets.empty()) {
+        lineOffsets.push_back(0);
+        for (size_t i = 0; i < translations.length(); i++) {
+            if (translations[i] == _T('\n'))
+                lineOffsets.push_back(i + 1);
+        }
+    }
+    auto lineOf = [this](size_t offset) {
+        return (size_t)(std::upper_bound(lineOffsets.begin(), lineOffsets.end(), offset) - lineOffsets.begin() - 1);
+    };
+
+    tstring report;
+    for (const ParseError &err : parseErrors) {
+        auto src = std::upper_bound(sources.begin(), sources.end(), err.offset,
+                                    [](size_t offset, const std::pair<size_t, tstring> &source) {
+            return offset < source.first;
+        });
+        size_t line = lineOf(err.offset), firstLine = 0;
+        tstring name;
+        if (src != sources.begin()) {
+            --src;
+            firstLine = lineOf(src->first);
+            name = src->second;
+        }
+        size_t lineStart = lineOffsets[line];
+        size_t excerptEnd = std::min(err.offset + 1, translations.length());
+        size_t excerptStart = std::max(lineStart, excerptEnd > MAX_ERROR_EXCERPT ? excerptEnd - MAX_ERROR_EXCERPT : 0);
+        tstring excerpt = translations.substr(excerptStart, excerptEnd - excerptStart);
+        while (!excerpt.empty() && (excerpt.back() == _T('\n') || excerpt.back() == _T('\r')))
+            excerpt.pop_back();
+
+        if (!report.empty())
+            report.push_back(_T('\n'));
+        if (!name.empty())
+            report.append(name + _T(":"));
+        report.append(to_tstring(line - firstLine + 1) + _T(":") + to_tstring(err.offset - lineStart + 1) + _T(": ")
+                      + err.message + _T(": ") + (excerptStart > lineStart ? _T("...") : _T("")) + excerpt + _T(" <---"));
+    }
+    if (errorCount > parseErrors.size())
+        report.append(_T("\n... ") + to_tstring(errorCount - parseErrors.size()) + _T(" more errors"));
+    return report;
+}
+
+void ISLParser::mergeTranslations(TranslationsMap &dst, const TranslationsMap &src)
+{
+    for (auto it = src.cbegin(); it != src.cend(); ++it) {
+        LocaleMap &localeMap = dst[it->first];
+        for (auto loc_it = it->second.cbegin(); loc_it != it->second.cend(); ++loc_it)
+            localeMap[loc_it->first] = loc_it->second;
+    }
+}
+
+void ISLParser::mergeTranslations(TranslationsMap &dst, MessagesMap &dstMessages, const TranslationsMap &src,
+                                  const MessagesMap &srcMessages)
+{
+    // A value replaced by a later file takes its message, or the lack of one, along
+    mergeTranslations(dst, src);
+    for (auto it = src.cbegin(); it != src.cend(); ++it) {
+        auto src_it = srcMessages.find(it->first);
+        if (src_it == srcMessages.end() && dstMessages.find(it->first) == dstMessages.end())
+            continue;
+        for (auto loc_it = it->second.cbegin(); loc_it != it->second.cend(); ++loc_it) {
+            if (src_it != srcMessages.end()) {
+                auto msg_it = src_it->second.find(loc_it->first);
+                if (msg_it != src_it->second.end()) {
+                    dstMessages[it->first][loc_it->first] = msg_it->second;
+                    continue;
+                }
+            }
+            auto dst_it = dstMessages.find(it->first);
+            if (dst_it != dstMessages.end())
+                dst_it->second.erase(loc_it->first);
+        }
+    }
 }
 
 void ISLParser::parseTranslations()
@@ -181,6 +412,9 @@ void ISLParser::parseTranslations()
     int token = TOKEN_BEGIN_DOCUMENT;
     tstring stringId, currentLocale;
     size_t pos = 0, len = translations.length();
+    parseErrors.clear();
+    errorCount = 0;
+    lineOffsets.clear();
     while (pos < len) {
         size_t incr = 1;
         tchar ch = translations.at(pos);
@@ -205,9 +439,9 @@ void ISLParser::parseTranslations()
                         token = TOKEN_BEGIN_LOCALE;
                         continue;
                     } else {
-                        // TOKEN_ERROR
-                        error_substr = translations.substr(0, pos + 1);
-                        return;
+                        // TOKEN_ERROR, resume on the next line
+                        incr = addError(pos, _T("invalid locale")) - pos;
+                        token = TOKEN_END_VALUE;
                     }
                 }
             }
@@ -222,11 +456,11 @@ void ISLParser::parseTranslations()
                     if (!isValidStringIdCharacter(c))
                         break;
                 }
-                c = translations.at(end);
                 if (end < len && !isSeparator(c) && c != _T('=')) {
                     // TOKEN_ERROR
-                    error_substr = translations.substr(0, end + 1);
-                    return;
+                    incr = addError(end, _T("invalid character in string ID")) - pos;
+                    token = TOKEN_END_VALUE;
+                    break;
                 }
                 stringId = translations.substr(pos, end - pos);
                 if (!stringId.empty() && translMap.find(stringId) == translMap.end())
@@ -243,8 +477,8 @@ void ISLParser::parseTranslations()
                     token = TOKEN_BEGIN_VALUE;
                 } else {
                     // TOKEN_ERROR
-                    error_substr = translations.substr(0, pos + 1);
-                    return;
+                    incr = addError(pos, _T("expected '='")) - pos;
+                    token = TOKEN_END_VALUE;
                 }
             }
             break;
@@ -257,10 +491,18 @@ void ISLParser::parseTranslations()
                     break;
             }
             size_t locale_len = end - pos;
+            if (!isLocaleWanted(translations.c_str() + pos, locale_len)) {
+                // skip the whole line without touching the id or the value
+                end = translations.find_first_of(_T('\n'), end);
+                incr = (end == tstring::npos) ? len - pos : end - pos;
+                token = TOKEN_END_VALUE;
+                break;
+            }
             currentLocale = translations.substr(pos, locale_len);
             if (pos + locale_len == len) {
-                error_substr = translations.substr(0, pos + locale_len);
-                return;
+                incr = addError(len, _T("unexpected end of document")) - pos;
+                token = TOKEN_END_VALUE;
+                break;
             }
             token = TOKEN_END_LOCALE;
             incr = locale_len;
@@ -273,8 +515,8 @@ void ISLParser::parseTranslations()
                     token = TOKEN_BEGIN_STRING_ID;
                 } else {
                     // TOKEN_ERROR
-                    error_substr = translations.substr(0, pos + 1);
-                    return;
+                    incr = addError(pos, _T("expected '.' after locale")) - pos;
+                    token = TOKEN_END_VALUE;
                 }
             }
             break;
@@ -293,14 +535,42 @@ void ISLParser::parseTranslations()
             if (!val.empty() && val.back() == _T('\r'))
                 val.pop_back();
 
+            // Escapes shorten the value, their positions map message errors back to the source
+            std::vector<size_t> escapes;
             size_t p = val.find(_T("\\n"));
             while (p != std::string::npos) {
                 val.replace(p, 2, _T("\\"));
                 val[p] = _T('\n');
+                escapes.push_back(p);
                 p = val.find(_T("\\n"), p + 1);
             }
-            if (!currentLocale.empty() && translMap.find(stringId) != translMap.end())
+            std::string nodes;
+            if (val.find(_T('{')) != tstring::npos && val.find(_T(',')) != tstring::npos) {
+                ISLMessage message;
+                size_t errorPos = 0;
+                const tchar *message_error = nullptr;
+                if (!NS_Plural::parseMessage(val, message, errorPos, message_error)) {
+                    size_t rawPos = errorPos + (std::lower_bound(escapes.begin(), escapes.end(), errorPos) - escapes.begin());
+                    addError(pos + std::min(rawPos, incr), message_error);
+                    token = TOKEN_END_VALUE;
+                    break;
+                }
+                if (NS_Plural::hasVariants(message) && !NS_Format::encodeMessage(message, nodes)) {
+                    addError(pos, _T("message is too long"));
+                    token = TOKEN_END_VALUE;
+                    break;
+                }
+            }
+            if (!currentLocale.empty() && translMap.find(stringId) != translMap.end()) {
                 translMap[stringId][currentLocale] = val;
+                if (!nodes.empty()) {
+                    messages[stringId][currentLocale] = std::move(nodes);
+                } else {
+                    auto msg_it = messages.find(stringId);
+                    if (msg_it != messages.end())
+                        msg_it->second.erase(currentLocale);
+                }
+            }
 
             token = TOKEN_END_VALUE;
             break;
@@ -314,6 +584,6 @@ void ISLParser::parseTranslations()
             token = TOKEN_END_DOCUMENT;
     }
 
-    if (token == TOKEN_END_DOCUMENT)
+    if (token == TOKEN_END_DOCUMENT && errorCount == 0)
         is_translations_valid = true;
 }
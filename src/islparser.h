@@ -1,23 +1,7 @@
 #ifndef ISLPARSER_H
 #define ISLPARSER_H
 
-#include <unordered_map>
-#include <string>
-#include <vector>
-#ifdef _WIN32
-# include <tchar.h>
-# define tchar wchar_t
-  typedef std::wstring tstring;
-#else
-# define _T(str) str
-# define tchar char
-  typedef std::string tstring;
-#endif
-
-using std::unordered_map;
-
-typedef unordered_map<tstring, tstring> LocaleMap;
-typedef unordered_map<tstring, LocaleMap> TranslationsMap;
+#include "islformat.h"
 
 
 class ISLParser
@@ -29,14 +13,38 @@ public:
     void verify(const std::vector<tstring> &islFilePaths, tstring &error);
     bool translationToBin(const std::vector<tstring> &islFilePaths, const tstring &binFilePath, tstring &error);
     static bool binToTranslation(const tstring &binFilePath, const tstring &islFilePath);
+    bool parseFile(const tstring &islFilePath, tstring &error);
+    bool parseData(const std::string &data, tstring &error, const tstring &sourceName = tstring());
+    const TranslationsMap& translationsMap() const;
+    TranslationsMap takeTranslationsMap();
+    const MessagesMap& messagesMap() const;
+    MessagesMap takeMessagesMap();
+    void setBinOptions(const ISLBinOptions &options);
+    static void mergeTranslations(TranslationsMap &dst, const TranslationsMap &src);
+    static void mergeTranslations(TranslationsMap &dst, MessagesMap &dstMessages, const TranslationsMap &src,
+                                  const MessagesMap &srcMessages);
+    static void formatTranslations(const TranslationsMap &translMap, std::string &out);
 
 private:
+    struct ParseError {
+        size_t       offset;
+        const tchar *message;
+    };
+
     void parseTranslations();
+    bool isLocaleWanted(const tchar *locale, size_t length) const;
+    size_t addError(size_t offset, const tchar *message);
+    tstring errorReport();
 
     TranslationsMap translMap;
-    tstring  translations,
-             error_substr;
+    MessagesMap     messages;  // values with plural or select, kept for serialize
+    ISLBinOptions   binOptions;
+    tstring  translations;
     bool     is_translations_valid;
+    std::vector<ParseError> parseErrors;
+    size_t   errorCount;
+    std::vector<std::pair<size_t, tstring>> sources;
+    std::vector<size_t> lineOffsets;
 
     enum TokenType {
         TOKEN_BEGIN_DOCUMENT = 0,
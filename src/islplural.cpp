@@ -0,0 +1,545 @@
+#include "islplural.h"
+#include "utils.h"
+#include <algorithm>
+#include <cstring>
+
+
+struct PluralRuleSource
+{
+    const char *languages;
+    const char *rules;
+};
+
+// CLDR cardinal rules restricted to integer operands (i = n, v = 0)
+static const PluralRuleSource PLURAL_RULES[] = {
+    {"ja zh ko vi th id ms lo my km", ""},
+    {"en de nl sv da nb nn no fi et el hu bg tr eu gl af sw ur ka az kk ky uz sq hy mn ne ps pt_PT",
+        "one: n = 1"},
+    {"it es ca", "one: n = 1; many: n != 0 and n % 1000000 = 0"},
+    {"fr pt", "one: n = 0,1; many: n != 0 and n % 1000000 = 0"},
+    {"hi bn fa gu kn mr zu am as", "one: n = 0,1"},
+    {"is mk", "one: n % 10 = 1 and n % 100 != 11"},
+    {"ru uk be", "one: n % 10 = 1 and n % 100 != 11; few: n % 10 = 2..4 and n % 100 != 12..14; "
+                 "many: n % 10 = 0 or n % 10 = 5..9 or n % 100 = 11..14"},
+    {"hr sr bs", "one: n % 10 = 1 and n % 100 != 11; few: n % 10 = 2..4 and n % 100 != 12..14"},
+    {"pl", "one: n = 1; few: n % 10 = 2..4 and n % 100 != 12..14; "
+           "many: n != 1 and n % 10 = 0..1 or n % 10 = 5..9 or n % 100 = 12..14"},
+    {"cs sk", "one: n = 1; few: n = 2..4"},
+    {"lt", "one: n % 10 = 1 and n % 100 != 11..19; few: n % 10 = 2..9 and n % 100 != 11..19"},
+    {"lv", "zero: n % 10 = 0 or n % 100 = 11..19; one: n % 10 = 1 and n % 100 != 11"},
+    {"ro", "one: n = 1; few: n = 0 or n != 1 and n % 100 = 1..19"},
+    {"sl", "one: n % 100 = 1; two: n % 100 = 2; few: n % 100 = 3..4"},
+    {"he", "one: n = 1; two: n = 2"},
+    {"ar", "zero: n = 0; one: n = 1; two: n = 2; few: n % 100 = 3..10; many: n % 100 = 11..99"},
+    {"ga", "one: n = 1; two: n = 2; few: n = 3..6; many: n = 7..10"},
+    {"cy", "zero: n = 0; one: n = 1; two: n = 2; few: n = 3; many: n = 6"}
+};
+
+static const char* const CATEGORY_NAMES[] = {"zero", "one", "two", "few", "many", "other"};
+
+
+static void skipSpaces(const char *&p)
+{
+    while (*p == ' ')
+        p++;
+}
+
+static bool skipWord(const char *&p, const char *word)
+{
+    size_t len = strlen(word);
+    if (strncmp(p, word, len) != 0 || (p[len] != ' ' && p[len] != '\0'))
+        return false;
+    p += len;
+    skipSpaces(p);
+    return true;
+}
+
+static bool parseNumber(const char *&p, uint32_t &value)
+{
+    if (*p < '0' || *p > '9')
+        return false;
+    value = 0;
+    while (*p >= '0' && *p <= '9')
+        value = value * 10 + (*p++ - '0');
+    skipSpaces(p);
+    return true;
+}
+
+static bool parseTerm(const char *&p, ISLPluralTerm &term)
+{
+    // n [% mod] (=|!=) a[..b], ...
+    if (*p != 'n' && *p != 'i')
+        return false;
+    p++;
+    skipSpaces(p);
+    term.mod = 0;
+    if (*p == '%') {
+        p++;
+        skipSpaces(p);
+        if (!parseNumber(p, term.mod) || term.mod == 0)
+            return false;
+    }
+    term.negate = (*p == '!');
+    if (term.negate)
+        p++;
+    if (*p++ != '=')
+        return false;
+    skipSpaces(p);
+    for (;;) {
+        ISLPluralRange range;
+        if (!parseNumber(p, range.lo))
+            return false;
+        range.hi = range.lo;
+        if (p[0] == '.' && p[1] == '.') {
+            p += 2;
+            if (!parseNumber(p, range.hi) || range.hi < range.lo)
+                return false;
+        }
+        term.ranges.push_back(range);
+        if (*p != ',')
+            return true;
+        p++;
+        skipSpaces(p);
+    }
+}
+
+static bool compileRules(const char *source, ISLPluralRules &rules)
+{
+    // "category: condition; ...", 'and' binds tighter than 'or'
+    const char *p = source;
+    skipSpaces(p);
+    while (*p) {
+        ISLPluralRule rule;
+        rule.category = ISL_PLURAL_OTHER;
+        for (uint8_t i = 0; i < ISL_PLURAL_OTHER; i++) {
+            size_t len = strlen(CATEGORY_NAMES[i]);
+            if (strncmp(p, CATEGORY_NAMES[i], len) == 0 && p[len] == ':') {
+                rule.category = i;
+                p += len + 1;
+                break;
+            }
+        }
+        if (rule.category == ISL_PLURAL_OTHER)
+            return false;
+        skipSpaces(p);
+        do {
+            ISLPluralClause clause;
+            do {
+                ISLPluralTerm term;
+                if (!parseTerm(p, term))
+                    return false;
+                clause.push_back(term);
+            } while (skipWord(p, "and"));
+            rule.clauses.push_back(clause);
+        } while (skipWord(p, "or"));
+        rules.push_back(rule);
+        if (*p == ';') {
+            p++;
+            skipSpaces(p);
+        } else
+        if (*p) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool isIdentCharacter(tchar c)
+{
+    return (c >= _T('a') && c <= _T('z')) || (c >= _T('A') && c <= _T('Z')) || (c >= _T('0') && c <= _T('9')) || c == _T('_');
+}
+
+static size_t scanIdent(const tstring &value, size_t pos)
+{
+    while (pos < value.length() && isIdentCharacter(value[pos]))
+        pos++;
+    return pos;
+}
+
+static size_t skipBlanks(const tstring &value, size_t pos)
+{
+    while (pos < value.length() && (value[pos] == _T(' ') || value[pos] == _T('\t')))
+        pos++;
+    return pos;
+}
+
+static bool isSelector(const tstring &value, size_t pos)
+{
+    // '{name, plural|select,' starts a variant, other brace groups are literal text
+    size_t end = scanIdent(value, pos + 1);
+    if (end == pos + 1)
+        return false;
+    pos = skipBlanks(value, end);
+    if (pos == value.length() || value[pos] != _T(','))
+        return false;
+    pos = skipBlanks(value, pos + 1);
+    end = scanIdent(value, pos);
+    tstring keyword = value.substr(pos, end - pos);
+    return keyword == _T("plural") || keyword == _T("select");
+}
+
+static size_t matchingBrace(const tstring &value, size_t pos)
+{
+    size_t depth = 0;
+    for (; pos < value.length(); pos++) {
+        if (value[pos] == _T('{')) {
+            depth++;
+        } else
+        if (value[pos] == _T('}') && --depth == 0) {
+            return pos;
+        }
+    }
+    return tstring::npos;
+}
+
+static void addNode(ISLMessage &message, uint8_t kind, const tstring &text = tstring(), uint32_t value = 0)
+{
+    ISLVariantNode node;
+    node.kind = kind;
+    node.category = 0;
+    node.value = value;
+    node.size = 0;
+    node.text = text;
+    message.nodes.push_back(node);
+}
+
+static bool parseNodes(const tstring &value, size_t &pos, bool nested, bool inPlural, ISLMessage &message, const tchar *&error);
+
+static bool parseSelector(const tstring &value, size_t &pos, bool inPlural, ISLMessage &message, const tchar *&error)
+{
+    // pos is at '{', the argument name and ',' are already known to follow
+    size_t end = scanIdent(value, pos + 1);
+    tstring name = value.substr(pos + 1, end - pos - 1);
+    pos = skipBlanks(value, skipBlanks(value, end) + 1);
+    end = scanIdent(value, pos);
+    tstring keyword = value.substr(pos, end - pos);
+    uint8_t kind;
+    if (keyword == _T("plural")) {
+        kind = ISL_VARIANT_PLURAL;
+    } else
+    if (keyword == _T("select")) {
+        kind = ISL_VARIANT_SELECT;
+    } else {
+        error = _T("expected 'plural' or 'select'");
+        return false;
+    }
+    pos = skipBlanks(value, end);
+    if (pos == value.length() || value[pos] != _T(',')) {
+        error = _T("expected ','");
+        return false;
+    }
+    pos++;
+
+    size_t selector = message.nodes.size();
+    addNode(message, kind, name);
+    std::vector<tstring> keys;
+    bool hasOther = false;
+    for (;;) {
+        pos = skipBlanks(value, pos);
+        if (pos == value.length()) {
+            error = _T("missing '}'");
+            return false;
+        }
+        if (value[pos] == _T('}')) {
+            pos++;
+            break;
+        }
+
+        size_t caseIndex = message.nodes.size();
+        addNode(message, ISL_VARIANT_CASE);
+        ISLVariantNode &node = message.nodes.back();
+        if (kind == ISL_VARIANT_PLURAL && value[pos] == _T('=')) {
+            end = pos + 1;
+            uint64_t number = 0;
+            while (end < value.length() && value[end] >= _T('0') && value[end] <= _T('9') && number <= UINT32_MAX)
+                number = number * 10 + (value[end++] - _T('0'));
+            if (end == pos + 1 || number > UINT32_MAX) {
+                error = _T("expected a number after '='");
+                return false;
+            }
+            node.category = ISL_PLURAL_EXACT;
+            node.value = (uint32_t)number;
+        } else {
+            end = scanIdent(value, pos);
+            if (end == pos) {
+                error = _T("expected a variant key");
+                return false;
+            }
+            node.text = value.substr(pos, end - pos);
+            if (kind == ISL_VARIANT_PLURAL) {
+                node.category = ISL_PLURAL_EXACT;
+                for (uint8_t i = 0; i <= ISL_PLURAL_OTHER; i++) {
+                    if (node.text == NS_Utils::Utf8ToTStr(CATEGORY_NAMES[i]))
+                        node.category = i;
+                }
+                if (node.category == ISL_PLURAL_EXACT) {
+                    error = _T("unknown plural category");
+                    return false;
+                }
+                node.text.clear();
+            }
+        }
+        tstring key = value.substr(pos, end - pos);
+        if (std::find(keys.begin(), keys.end(), key) != keys.end()) {
+            error = _T("duplicate variant key");
+            return false;
+        }
+        keys.push_back(key);
+        hasOther = hasOther || key == _T("other");
+
+        pos = skipBlanks(value, end);
+        if (pos == value.length() || value[pos] != _T('{')) {
+            error = _T("expected '{'");
+            return false;
+        }
+        pos++;
+        if (!parseNodes(value, pos, true, inPlural || kind == ISL_VARIANT_PLURAL, message, error))
+            return false;
+        pos++;
+        if (message.nodes.size() - caseIndex - 1 > UINT16_MAX) {
+            error = _T("variant is too large");
+            return false;
+        }
+        message.nodes[caseIndex].size = (uint16_t)(message.nodes.size() - caseIndex - 1);
+    }
+    if (!hasOther) {
+        error = _T("missing 'other' variant");
+        return false;
+    }
+    if (message.nodes.size() - selector - 1 > UINT16_MAX) {
+        error = _T("variant is too large");
+        return false;
+    }
+    message.nodes[selector].size = (uint16_t)(message.nodes.size() - selector - 1);
+    return true;
+}
+
+static bool parseNodes(const tstring &value, size_t &pos, bool nested, bool inPlural, ISLMessage &message, const tchar *&error)
+{
+    tstring text;
+    auto flush = [&]() {
+        if (!text.empty()) {
+            addNode(message, ISL_VARIANT_TEXT, text);
+            text.clear();
+        }
+    };
+    size_t len = value.length();
+    while (pos < len) {
+        tchar c = value[pos];
+        if (c == _T('}') && nested) {
+            flush();
+            return true;
+        }
+        if (c == _T('#') && inPlural) {
+            flush();
+            addNode(message, ISL_VARIANT_HASH);
+            pos++;
+            continue;
+        }
+        if (c == _T('%')) {
+            // Same rule as the placeholder segments: %1 .. %99
+            size_t end = pos + 1;
+            uint32_t index = 0;
+            while (end < len && end - pos < 3 && value[end] >= _T('0') && value[end] <= _T('9'))
+                index = index * 10 + (value[end++] - _T('0'));
+            if (end - pos > 1 && value[pos + 1] != _T('0')) {
+                flush();
+                addNode(message, ISL_VARIANT_INDEX, tstring(), index);
+                pos = end;
+                continue;
+            }
+        } else
+        if (c == _T('{')) {
+            size_t end = scanIdent(value, pos + 1);
+            if (end > pos + 1 && end < len && value[end] == _T('}')) {
+                flush();
+                addNode(message, ISL_VARIANT_NAME, value.substr(pos + 1, end - pos - 1));
+                pos = end + 1;
+                continue;
+            }
+            if (isSelector(value, pos)) {
+                flush();
+                if (!parseSelector(value, pos, inPlural, message, error))
+                    return false;
+                continue;
+            }
+            size_t close = matchingBrace(value, pos);
+            if (close != tstring::npos) {
+                text.append(value, pos, close - pos + 1);
+                pos = close + 1;
+                continue;
+            }
+            if (nested) {
+                error = _T("unexpected '{' in variant");
+                return false;
+            }
+        }
+        text.push_back(c);
+        pos++;
+    }
+    if (nested) {
+        error = _T("missing '}'");
+        return false;
+    }
+    flush();
+    return true;
+}
+
+static bool parseInteger(const tstring &str, uint64_t &n)
+{
+    size_t pos = (!str.empty() && (str[0] == _T('-') || str[0] == _T('+'))) ? 1 : 0;
+    if (pos == str.length())
+        return false;
+    n = 0;
+    for (; pos < str.length(); pos++) {
+        if (str[pos] < _T('0') || str[pos] > _T('9'))
+            return false;
+        n = n * 10 + (str[pos] - _T('0'));
+    }
+    return true;
+}
+
+static void renderNodes(const ISLMessage &message, size_t begin, size_t end, const ISLPluralRules &rules,
+                        const std::vector<tstring> &args, const unordered_map<tstring, tstring> &namedArgs,
+                        const tstring *number, tstring &value)
+{
+    size_t i = begin;
+    while (i < end) {
+        const ISLVariantNode &node = message.nodes[i];
+        switch (node.kind) {
+        case ISL_VARIANT_TEXT:
+            value.append(node.text);
+            break;
+
+        case ISL_VARIANT_HASH:
+            value.append(number ? *number : tstring(_T("#")));
+            break;
+
+        case ISL_VARIANT_INDEX:
+            if (node.value != 0 && node.value <= args.size())
+                value.append(args[node.value - 1]);
+            else
+                value.append(_T("%") + to_tstring(node.value));
+            break;
+
+        case ISL_VARIANT_NAME: {
+            auto it = namedArgs.find(node.text);
+            value.append(it != namedArgs.end() ? it->second : _T("{") + node.text + _T("}"));
+            break;
+        }
+
+        case ISL_VARIANT_PLURAL:
+        case ISL_VARIANT_SELECT: {
+            // An exact match wins over the category, 'other' is the fallback
+            auto it = namedArgs.find(node.text);
+            const tstring *arg = (it != namedArgs.end()) ? &it->second : nullptr;
+            uint64_t n = 0;
+            bool numeric = arg && node.kind == ISL_VARIANT_PLURAL && parseInteger(*arg, n);
+            uint8_t category = numeric ? NS_Plural::selectCategory(rules, n) : (uint8_t)ISL_PLURAL_OTHER;
+            size_t chosen = 0, other = 0, caseEnd = i + 1 + node.size;
+            for (size_t c = i + 1; c < caseEnd; c += 1 + message.nodes[c].size) {
+                const ISLVariantNode &cs = message.nodes[c];
+                bool isOther = (node.kind == ISL_VARIANT_PLURAL) ? cs.category == ISL_PLURAL_OTHER : cs.text == _T("other");
+                if (isOther)
+                    other = c;
+                if (node.kind == ISL_VARIANT_PLURAL) {
+                    if (numeric && cs.category == ISL_PLURAL_EXACT && cs.value == n) {
+                        chosen = c;
+                        break;
+                    }
+                    if (!chosen && cs.category == category)
+                        chosen = c;
+                } else
+                if (arg && cs.text == *arg) {
+                    chosen = c;
+                    break;
+                }
+            }
+            if (!chosen)
+                chosen = other;
+            if (chosen)
+                renderNodes(message, chosen + 1, chosen + 1 + message.nodes[chosen].size, rules, args, namedArgs,
+                            (node.kind == ISL_VARIANT_PLURAL) ? arg : number, value);
+            i = caseEnd;
+            continue;
+        }
+
+        default:
+            break;
+        }
+        i++;
+    }
+}
+
+namespace NS_Plural
+{
+    bool findRules(const tstring &locale, tstring &name, ISLPluralRules &rules)
+    {
+        // The full locale is tried before its language, e.g. pt_PT before pt
+        std::string loc = NS_Utils::TStrToUtf8(locale);
+        std::string lang = loc.substr(0, loc.find('_'));
+        for (const std::string &key : {loc, lang}) {
+            for (const PluralRuleSource &source : PLURAL_RULES) {
+                std::string languages = std::string(" ") + source.languages + " ";
+                if (languages.find(" " + key + " ") == std::string::npos)
+                    continue;
+                rules.clear();
+                if (!compileRules(source.rules, rules))
+                    return false;
+                name = NS_Utils::Utf8ToTStr(key);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint8_t selectCategory(const ISLPluralRules &rules, uint64_t n)
+    {
+        for (const ISLPluralRule &rule : rules) {
+            for (const ISLPluralClause &clause : rule.clauses) {
+                bool match = true;
+                for (const ISLPluralTerm &term : clause) {
+                    uint64_t x = term.mod ? n % term.mod : n;
+                    bool inRange = false;
+                    for (const ISLPluralRange &range : term.ranges)
+                        inRange = inRange || (x >= range.lo && x <= range.hi);
+                    if (inRange == (term.negate != 0)) {
+                        match = false;
+                        break;
+                    }
+                }
+                if (match)
+                    return rule.category;
+            }
+        }
+        return ISL_PLURAL_OTHER;
+    }
+
+    bool parseMessage(const tstring &value, ISLMessage &message, size_t &errorPos, const tchar *&error)
+    {
+        message.rules = 0;
+        message.nodes.clear();
+        size_t pos = 0;
+        if (!parseNodes(value, pos, false, false, message, error)) {
+            errorPos = pos;
+            return false;
+        }
+        return true;
+    }
+
+    bool hasVariants(const ISLMessage &message)
+    {
+        for (const ISLVariantNode &node : message.nodes) {
+            if (node.kind == ISL_VARIANT_PLURAL || node.kind == ISL_VARIANT_SELECT)
+                return true;
+        }
+        return false;
+    }
+
+    void formatMessage(const ISLMessage &message, const ISLPluralRules &rules, const std::vector<tstring> &args,
+                       const unordered_map<tstring, tstring> &namedArgs, tstring &value)
+    {
+        value.clear();
+        renderNodes(message, 0, message.nodes.size(), rules, args, namedArgs, nullptr, value);
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef ISLPLURAL_H
+#define ISLPLURAL_H
+
+#include "islformat.h"
+
+/*
+ * Values may contain ICU-style variants:
+ *   {count, plural, =0 {No files} one {# file} other {# files}}
+ *   {gender, select, female {She} male {He} other {They}}
+ * Cases hold text, placeholders and nested variants, '#' is the number of the
+ * enclosing plural. Every variant needs an 'other' case.
+ */
+
+#define ISL_VARIANT_TEXT   0
+#define ISL_VARIANT_HASH   1
+#define ISL_VARIANT_INDEX  2
+#define ISL_VARIANT_NAME   3
+#define ISL_VARIANT_PLURAL 4
+#define ISL_VARIANT_SELECT 5
+#define ISL_VARIANT_CASE   6
+
+#define ISL_PLURAL_ZERO    0
+#define ISL_PLURAL_ONE     1
+#define ISL_PLURAL_TWO     2
+#define ISL_PLURAL_FEW     3
+#define ISL_PLURAL_MANY    4
+#define ISL_PLURAL_OTHER   5
+#define ISL_PLURAL_EXACT   6
+
+struct ISLPluralRange
+{
+    uint32_t lo;
+    uint32_t hi;
+};
+
+// (mod ? n % mod : n) in ranges, inverted by negate
+struct ISLPluralTerm
+{
+    uint32_t mod;
+    uint8_t  negate;
+    std::vector<ISLPluralRange> ranges;
+};
+
+typedef std::vector<ISLPluralTerm> ISLPluralClause;
+
+// The category applies if all terms of any clause match
+struct ISLPluralRule
+{
+    uint8_t category;
+    std::vector<ISLPluralClause> clauses;
+};
+
+typedef std::vector<ISLPluralRule> ISLPluralRules;
+
+// Nodes are stored in pre-order, 'size' counts the nodes nested below a node
+struct ISLVariantNode
+{
+    uint8_t  kind;
+    uint8_t  category;  // plural CASE: ISL_PLURAL_*
+    uint32_t value;     // INDEX: argument number, exact plural CASE: the number
+    uint16_t size;      // PLURAL, SELECT, CASE
+    tstring  text;      // TEXT: literal, NAME, PLURAL, SELECT: argument name, select CASE: key
+};
+
+struct ISLMessage
+{
+    uint8_t rules;      // index into ISLVariants::rules
+    std::vector<ISLVariantNode> nodes;
+};
+
+struct ISLVariants
+{
+    std::vector<std::pair<tstring, ISLPluralRules>> rules;
+    unordered_map<tstring, unordered_map<tstring, ISLMessage>> messages;
+};
+
+namespace NS_Plural
+{
+bool findRules(const tstring &locale, tstring &name, ISLPluralRules &rules);
+uint8_t selectCategory(const ISLPluralRules &rules, uint64_t n);
+bool parseMessage(const tstring &value, ISLMessage &message, size_t &errorPos, const tchar *&error);
+bool hasVariants(const ISLMessage &message);
+void formatMessage(const ISLMessage &message, const ISLPluralRules &rules, const std::vector<tstring> &args,
+                   const unordered_map<tstring, tstring> &namedArgs, tstring &value);
+}
+
+#endif // ISLPLURAL_H
@@ -0,0 +1,340 @@
+#include "islreader.h"
+#include "utils.h"
+#include <functional>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+
+static unsigned readerShard()
+{
+    static thread_local unsigned shard = std::hash<std::thread::id>()(std::this_thread::get_id()) % READER_SHARDS;
+    return shard;
+}
+
+ISLReader::Snapshot::MappedFile::MappedFile() :
+    data(nullptr),
+    size(0)
+#ifdef _WIN32
+  , mapping(nullptr)
+#endif
+{
+
+}
+
+ISLReader::Snapshot::MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool ISLReader::Snapshot::MappedFile::open(const tstring &filePath)
+{
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0 || (unsigned long long)fileSize.QuadPart > SIZE_MAX) {
+        CloseHandle(file);
+        return false;
+    }
+    mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return false;
+    data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        mapping = nullptr;
+        return false;
+    }
+    size = (size_t)fileSize.QuadPart;
+#else
+    int fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || (unsigned long long)st.st_size > SIZE_MAX) {
+        ::close(fd);
+        return false;
+    }
+    void *ptr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED)
+        return false;
+    data = (const char*)ptr;
+    size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+void ISLReader::Snapshot::MappedFile::close()
+{
+    if (!data)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(mapping);
+    mapping = nullptr;
+#else
+    munmap((void*)data, size);
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+ISLReader::Snapshot::Snapshot() :
+    gen(0)
+{
+
+}
+
+static const tstring* findValue(const TranslationsMap &translMap, const tstring &stringId, const tstring &locale)
+{
+    auto it = translMap.find(stringId);
+    if (it == translMap.end())
+        return nullptr;
+    auto loc_it = it->second.find(locale);
+    return (loc_it != it->second.end()) ? &loc_it->second : nullptr;
+}
+
+const ISLReader::Snapshot::Namespace* ISLReader::Snapshot::namespaceOf(const tstring &stringId) const
+{
+    if (!namespaces)
+        return &all;
+    int ns = NS_Format::findNamespace(nsIndex, stringId);
+    if (ns < 0)
+        return nullptr;
+    Namespace &entry = namespaces[ns];
+    std::call_once(entry.loaded, [this, &entry, ns]() {
+        if (!NS_Format::deserializeNamespace(binFile.data, binFile.size, nsIndex, ns, entry.translMap,
+                                             &entry.segmentsMap, &entry.variants)) {
+            NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
+            entry.translMap.clear();
+            entry.segmentsMap.clear();
+            entry.variants.messages.clear();
+        }
+    });
+    return &entry;
+}
+
+const tstring* ISLReader::Snapshot::find(const tstring &stringId, const tstring &locale) const
+{
+    const Namespace *space = namespaceOf(stringId);
+    return space ? findValue(space->translMap, stringId, locale) : nullptr;
+}
+
+bool ISLReader::Snapshot::format(const tstring &stringId, const tstring &locale, const std::vector<tstring> &args,
+                                 const unordered_map<tstring, tstring> &namedArgs, tstring &value) const
+{
+    const Namespace *space = namespaceOf(stringId);
+    const tstring *val = space ? findValue(space->translMap, stringId, locale) : nullptr;
+    if (!val)
+        return false;
+    auto var_it = space->variants.messages.find(stringId);
+    if (var_it != space->variants.messages.end()) {
+        auto msg_it = var_it->second.find(locale);
+        if (msg_it != var_it->second.end()) {
+            const ISLMessage &message = msg_it->second;
+            NS_Plural::formatMessage(message, all.variants.rules[message.rules].second, args, namedArgs, value);
+            return true;
+        }
+    }
+    const SegmentsMap &segmentsMap = space->segmentsMap;
+    auto it = segmentsMap.find(stringId);
+    if (it == segmentsMap.end()) {
+        value = *val;
+        return true;
+    }
+    auto loc_it = it->second.locales.find(locale);
+    if (loc_it == it->second.locales.end()) {
+        value = *val;
+        return true;
+    }
+
+    // Placeholders without a matching argument are kept as written
+    value.clear();
+    for (const ISLSegment &seg : loc_it->second) {
+        if (seg.kind == ISL_SEGMENT_INDEX && seg.arg != 0 && seg.arg <= args.size()) {
+            value.append(args[seg.arg - 1]);
+            continue;
+        }
+        if (seg.kind == ISL_SEGMENT_NAME && seg.arg < it->second.names.size()) {
+            auto arg_it = namedArgs.find(it->second.names[seg.arg]);
+            if (arg_it != namedArgs.end()) {
+                value.append(arg_it->second);
+                continue;
+            }
+        }
+        value.append(*val, seg.offset, seg.length);
+    }
+    return true;
+}
+
+const TranslationsMap& ISLReader::Snapshot::translations() const
+{
+    // Decodes the whole bundle once if it was loaded by namespace
+    if (namespaces) {
+        std::call_once(all.loaded, [this]() {
+            if (!NS_Format::deserialize(binFile.data, binFile.size, all.translMap)) {
+                NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
+                all.translMap.clear();
+            }
+        });
+    }
+    return all.translMap;
+}
+
+const tstring& ISLReader::Snapshot::filePath() const
+{
+    return binFilePath;
+}
+
+unsigned long ISLReader::Snapshot::generation() const
+{
+    return gen;
+}
+
+ISLReader::ReadGuard::ReadGuard(const ISLReader &reader)
+{
+    // Register in the reader counter of the current epoch and re-check the epoch,
+    // so a concurrent publish either waits for us or we retry in the new epoch.
+    unsigned shard = readerShard();
+    for (;;) {
+        unsigned e = reader.epoch.load();
+        counter = &reader.readers[e & 1][shard].count;
+        counter->fetch_add(1);
+        if (reader.epoch.load() == e)
+            break;
+        counter->fetch_sub(1);
+    }
+    snapshot = reader.current.load();
+}
+
+ISLReader::ReadGuard::~ReadGuard()
+{
+    counter->fetch_sub(1, std::memory_order_release);
+}
+
+const ISLReader::Snapshot* ISLReader::ReadGuard::get() const
+{
+    return snapshot;
+}
+
+const ISLReader::Snapshot* ISLReader::ReadGuard::operator->() const
+{
+    return snapshot;
+}
+
+ISLReader::ISLReader() :
+    current(nullptr),
+    epoch(0),
+    reloadResult(false),
+    lastGen(0)
+{
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < READER_SHARDS; j++)
+            readers[i][j].count = 0;
+    }
+}
+
+ISLReader::~ISLReader()
+{
+    if (reloadThread.joinable())
+        reloadThread.join();
+    delete current.load();
+}
+
+bool ISLReader::load(const tstring &binFilePath)
+{
+    Snapshot *snapshot = new Snapshot;
+    snapshot->binFilePath = binFilePath;
+    Snapshot::MappedFile &file = snapshot->binFile;
+    if (!file.open(binFilePath)) {
+        NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
+        delete snapshot;
+        return false;
+    }
+    ISLHeader header;
+    bool lazy = NS_Format::readHeader(file.data, file.size, header) && (header.flags & ISL_FLAG_NAMESPACES);
+    if (lazy ? !NS_Format::readNamespaces(file.data, file.size, snapshot->nsIndex, &snapshot->all.variants)
+             : !NS_Format::deserialize(file.data, file.size, snapshot->all.translMap, &snapshot->all.segmentsMap,
+                                       &snapshot->all.variants)) {
+        NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
+        delete snapshot;
+        return false;
+    }
+    if (lazy)
+        snapshot->namespaces.reset(new Snapshot::Namespace[snapshot->nsIndex.namespaces.size()]);
+    else
+        file.close();
+    publish(snapshot);
+    return true;
+}
+
+void ISLReader::reloadAsync(const tstring &binFilePath)
+{
+    if (reloadThread.joinable())
+        reloadThread.join();
+    reloadThread = std::thread([this, binFilePath]() {
+        reloadResult = load(binFilePath);
+    });
+}
+
+bool ISLReader::waitForReload()
+{
+    if (reloadThread.joinable())
+        reloadThread.join();
+    return reloadResult;
+}
+
+bool ISLReader::lookup(const tstring &stringId, const tstring &locale, tstring &value) const
+{
+    ReadGuard guard(*this);
+    if (!guard.get())
+        return false;
+    const tstring *val = guard->find(stringId, locale);
+    if (!val)
+        return false;
+    value = *val;
+    return true;
+}
+
+bool ISLReader::format(const tstring &stringId, const tstring &locale, const std::vector<tstring> &args,
+                       const unordered_map<tstring, tstring> &namedArgs, tstring &value) const
+{
+    ReadGuard guard(*this);
+    return guard.get() && guard->format(stringId, locale, args, namedArgs, value);
+}
+
+unsigned long ISLReader::generation() const
+{
+    ReadGuard guard(*this);
+    return guard.get() ? guard->generation() : 0;
+}
+
+void ISLReader::publish(Snapshot *snapshot)
+{
+    std::lock_guard<std::mutex> lock(writerMutex);
+    snapshot->gen = ++lastGen;
+    const Snapshot *old = current.exchange(snapshot);
+    unsigned e = epoch.fetch_add(1);
+    synchronize(e & 1);
+    delete old;
+}
+
+void ISLReader::synchronize(unsigned parity)
+{
+    // Wait until every reader that entered before the swap has left
+    for (int i = 0; i < READER_SHARDS; i++) {
+        while (readers[parity][i].count.load(std::memory_order_acquire) != 0)
+            std::this_thread::yield();
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef ISLREADER_H
+#define ISLREADER_H
+
+#include "islapi.h"
+#include "islparser.h"
+#include "islplural.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#define READER_SHARDS 8
+
+
+// Lookups take no lock against reloads: a ReadGuard may retry while a new snapshot is
+// published, and the first lookup in a namespace waits until that namespace is decoded.
+class ISL_API ISLReader
+{
+public:
+    class ISL_API Snapshot
+    {
+    public:
+        const tstring* find(const tstring &stringId, const tstring &locale) const;
+        bool format(const tstring &stringId, const tstring &locale, const std::vector<tstring> &args,
+                    const unordered_map<tstring, tstring> &namedArgs, tstring &value) const;
+        // For namespaced bundles this decodes a second, complete copy next to the
+        // namespaces already loaded, meant for dumps rather than lookups
+        const TranslationsMap& translations() const;
+        const tstring& filePath() const;
+        unsigned long generation() const;
+
+    private:
+        friend class ISLReader;
+
+        struct Namespace
+        {
+            std::once_flag  loaded;
+            TranslationsMap translMap;
+            SegmentsMap     segmentsMap;
+            ISLVariants     variants;
+        };
+
+        // Read-only view of the bundle file, bundles are replaced by rename so the mapping stays valid
+        struct MappedFile
+        {
+            MappedFile();
+            ~MappedFile();
+            bool open(const tstring &filePath);
+            void close();
+
+            const char *data;
+            size_t      size;
+#ifdef _WIN32
+            void       *mapping;
+#endif
+        };
+
+        Snapshot();
+        const Namespace* namespaceOf(const tstring &stringId) const;
+
+        // Bundles with a namespace index stay mapped and decode a namespace on first use,
+        // 'all' then holds only the plural rules until translations() is called
+        mutable Namespace            all;
+        std::unique_ptr<Namespace[]> namespaces;
+        ISLNamespaceIndex            nsIndex;
+        MappedFile                   binFile;
+        tstring                      binFilePath;
+        unsigned long                gen;
+    };
+
+    class ISL_API ReadGuard
+    {
+    public:
+        explicit ReadGuard(const ISLReader &reader);
+        ~ReadGuard();
+
+        const Snapshot* get() const;
+        const Snapshot* operator->() const;
+
+    private:
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        std::atomic<unsigned> *counter;
+        const Snapshot *snapshot;
+    };
+
+    ISLReader();
+    ~ISLReader();
+
+    bool load(const tstring &binFilePath);
+    void reloadAsync(const tstring &binFilePath);
+    bool waitForReload();
+    bool lookup(const tstring &stringId, const tstring &locale, tstring &value) const;
+    bool format(const tstring &stringId, const tstring &locale, const std::vector<tstring> &args,
+                const unordered_map<tstring, tstring> &namedArgs, tstring &value) const;
+    unsigned long generation() const;
+
+private:
+    ISLReader(const ISLReader&) = delete;
+    ISLReader& operator=(const ISLReader&) = delete;
+
+    void publish(Snapshot *snapshot);
+    void synchronize(unsigned parity);
+
+    struct alignas(64) ReaderCounter {
+        std::atomic<unsigned> count;
+    };
+
+    std::atomic<const Snapshot*> current;
+    std::atomic<unsigned> epoch;
+    mutable ReaderCounter readers[2][READER_SHARDS];
+    std::atomic<bool> reloadResult;
+    std::mutex        writerMutex;
+    std::thread       reloadThread;
+    unsigned long     lastGen;
+};
+
+#endif // ISLREADER_H
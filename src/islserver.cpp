@@ -0,0 +1,261 @@
+#include "islserver.h"
+#include "threadpool.h"
+#include "utils.h"
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_REQUEST_SIZE 65536
+#define REQUEST_TIMEOUT_SEC 10
+#define MAX_CACHE_ENTRIES 1024
+
+
+static bool writeAll(int fd, const std::string &data)
+{
+    size_t pos = 0;
+    while (pos < data.size()) {
+        ssize_t n = ::write(fd, data.data() + pos, data.size() - pos);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        pos += n;
+    }
+    return true;
+}
+
+ISLServer::ISLServer() :
+    cacheClock(0),
+    stopping(false),
+    listenFd(-1)
+{
+
+}
+
+ISLServer::~ISLServer()
+{
+    if (listenFd != -1)
+        ::close(listenFd);
+}
+
+void ISLServer::setBinOptions(const ISLBinOptions &options)
+{
+    binOptions = options;
+}
+
+bool ISLServer::run(const tstring &socketPath, unsigned jobs, tstring &error)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.length() >= sizeof(addr.sun_path)) {
+        error = _T("invalid socket path: ") + socketPath;
+        return false;
+    }
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd == -1) {
+        error = _T("cannot create socket: ") + tstring(strerror(errno));
+        return false;
+    }
+    // Only a stale socket is replaced, never a file given by mistake
+    struct stat st;
+    if (::lstat(socketPath.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            error = _T("not a socket, refusing to replace: ") + socketPath;
+            return false;
+        }
+        ::unlink(socketPath.c_str());
+    }
+    if (::bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listenFd, SOMAXCONN) != 0) {
+        error = _T("cannot listen on ") + socketPath + _T(": ") + tstring(strerror(errno));
+        return false;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    ThreadPool pool(jobs);
+    while (!stopping) {
+        int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (!stopping)
+                error = _T("accept failed: ") + tstring(strerror(errno));
+            break;
+        }
+        pool.submit([this, fd]() {
+            handleClient(fd);
+        });
+    }
+    pool.wait();
+    ::close(listenFd);
+    listenFd = -1;
+    ::unlink(socketPath.c_str());
+    return error.empty();
+}
+
+void ISLServer::handleClient(int fd)
+{
+    // Idle or slow clients must not hold a worker, so the whole request has one deadline
+    timeval timeout = { REQUEST_TIMEOUT_SEC, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(REQUEST_TIMEOUT_SEC);
+    std::string request;
+    char buf[4096];
+    bool timedOut = false;
+    while (request.find('\n') == std::string::npos && request.size() <= MAX_REQUEST_SIZE) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        pollfd pfd = { fd, POLLIN, 0 };
+        int ready = left.count() > 0 ? ::poll(&pfd, 1, (int)left.count()) : 0;
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready == 0)
+            timedOut = true;
+        if (ready <= 0)
+            break;
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        request.append(buf, n);
+    }
+    size_t end = request.find('\n');
+    if (end != std::string::npos)
+        request.resize(end);
+
+    std::vector<tstring> args;
+    tstring response;
+    if (request.size() > MAX_REQUEST_SIZE)
+        response = _T("ERROR\nrequest too long\n");
+    else
+    if (timedOut)
+        response = _T("ERROR\nrequest timed out\n");
+    else
+    if (!NS_Utils::SplitLine(request, args) || args.empty())
+        response = _T("ERROR\nmalformed request\n");
+    else
+        response = handleRequest(args);
+    writeAll(fd, response);
+    ::close(fd);
+}
+
+tstring ISLServer::handleRequest(const std::vector<tstring> &args)
+{
+    const tstring &cmd = args[0];
+    if (cmd == _T("compile") && args.size() > 2) {
+        Parsed merged;
+        std::shared_ptr<const Parsed> parsed;
+        for (size_t i = 2; i < args.size(); i++) {
+            tstring err;
+            if (!parse(args[i], parsed, err))
+                return _T("ERROR\n") + err + _T("\n");
+            if (args.size() > 3)
+                ISLParser::mergeTranslations(merged.translMap, merged.messages, parsed->translMap, parsed->messages);
+        }
+        const TranslationsMap &result = (args.size() > 3) ? merged.translMap : parsed->translMap;
+        const MessagesMap &messages = (args.size() > 3) ? merged.messages : parsed->messages;
+        if (result.empty())
+            return _T("ERROR\ntranslations map is empty!\n");
+        tstring err;
+        if (binOptions.segments && !NS_Format::checkPlaceholders(result, binOptions.sourceLocale, err))
+            return _T("ERROR\n") + err;
+        if (!NS_File::writeBinFile(args[1], result, binOptions, &messages))
+            return _T("ERROR\ncannot write file ") + args[1] + _T("\n");
+        return _T("OK\n") + args[1] + _T("\n");
+
+    } else
+    if (cmd == _T("verify") && args.size() > 1) {
+        tstring report;
+        bool valid = true;
+        for (size_t i = 1; i < args.size(); i++) {
+            tstring err;
+            std::shared_ptr<const Parsed> parsed;
+            if (!parse(args[i], parsed, err)) {
+                report.append(err + _T("\n"));
+                valid = false;
+            } else
+            if (parsed->translMap.empty()) {
+                report.append(args[i] + _T(": translations map is empty!\n"));
+                valid = false;
+            } else
+            if (binOptions.segments && !NS_Format::checkPlaceholders(parsed->translMap, binOptions.sourceLocale, err)) {
+                report.append(args[i] + _T(":\n") + err);
+                valid = false;
+            } else {
+                report.append(args[i] + _T(": ok\n"));
+            }
+        }
+        return (valid ? _T("OK\n") : _T("ERROR\n")) + report;
+
+    } else
+    if (cmd == _T("decode") && args.size() == 3) {
+        if (!ISLParser::binToTranslation(args[1], args[2]))
+            return _T("ERROR\ncannot decode ") + args[1] + _T("\n");
+        return _T("OK\n") + args[2] + _T("\n");
+
+    } else
+    if (cmd == _T("shutdown") && args.size() == 1) {
+        stopping = true;
+        ::shutdown(listenFd, SHUT_RDWR);
+        return _T("OK\n");
+    }
+    return _T("ERROR\nunknown request: ") + cmd + _T("\n");
+}
+
+bool ISLServer::parse(const tstring &filePath, std::shared_ptr<const Parsed> &parsed, tstring &error)
+{
+    // Parse results are reused until the file's size or modification time changes
+    struct stat st;
+    if (::stat(filePath.c_str(), &st) != 0) {
+        error = _T("cannot read file ") + filePath;
+        return false;
+    }
+    int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = cache.find(filePath);
+        if (it != cache.end() && it->second.mtime == mtime && it->second.size == st.st_size) {
+            it->second.lastUse = ++cacheClock;
+            parsed = it->second.parsed;
+            error = it->second.error;
+            return it->second.valid;
+        }
+    }
+
+    ISLParser isl;
+    isl.setBinOptions(binOptions);
+    CacheEntry entry;
+    entry.mtime = mtime;
+    entry.size = st.st_size;
+    entry.valid = isl.parseFile(filePath, entry.error);
+    std::shared_ptr<Parsed> result = std::make_shared<Parsed>();
+    result->translMap = isl.takeTranslationsMap();
+    result->messages = isl.takeMessagesMap();
+    entry.parsed = result;
+    {
+        // The least recently used entry makes room once the cache is full
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (cache.size() >= MAX_CACHE_ENTRIES && cache.find(filePath) == cache.end()) {
+            auto oldest = cache.begin();
+            for (auto it = cache.begin(); it != cache.end(); ++it) {
+                if (it->second.lastUse < oldest->second.lastUse)
+                    oldest = it;
+            }
+            cache.erase(oldest);
+        }
+        entry.lastUse = ++cacheClock;
+        cache[filePath] = entry;
+    }
+    parsed = entry.parsed;
+    error = entry.error;
+    return entry.valid;
+}
@@ -0,0 +1,51 @@
+#ifndef ISLSERVER_H
+#define ISLSERVER_H
+
+#include "islparser.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <sys/types.h>
+
+
+class ISLServer
+{
+public:
+    ISLServer();
+    ~ISLServer();
+
+    void setBinOptions(const ISLBinOptions &options);
+    bool run(const tstring &socketPath, unsigned jobs, tstring &error);
+
+private:
+    ISLServer(const ISLServer&) = delete;
+    ISLServer& operator=(const ISLServer&) = delete;
+
+    struct Parsed {
+        TranslationsMap translMap;
+        MessagesMap     messages;
+    };
+
+    struct CacheEntry {
+        int64_t  mtime;
+        off_t    size;
+        bool     valid;
+        uint64_t lastUse;
+        tstring error;
+        std::shared_ptr<const Parsed> parsed;
+    };
+
+    void handleClient(int fd);
+    tstring handleRequest(const std::vector<tstring> &args);
+    bool parse(const tstring &filePath, std::shared_ptr<const Parsed> &parsed, tstring &error);
+
+    unordered_map<tstring, CacheEntry> cache;
+    uint64_t          cacheClock;
+    std::mutex        cacheMutex;
+    ISLBinOptions     binOptions;
+    std::atomic<bool> stopping;
+    int               listenFd;
+};
+
+#endif // ISLSERVER_H
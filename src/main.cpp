@@ -1,13 +1,21 @@
 #include "islparser.h"
+#include "islcoverage.h"
+#include "islmanifest.h"
+#ifdef __linux__
+# include "islserver.h"
+#endif
+#include "threadpool.h"
 #include "utils.h"
 #include <locale>
 #ifdef _WIN32
 # define tstrcmp wcscmp
 # define tprintf wprintf
+# define tstrtoul wcstoul
 #else
 # include <cstring>
 # define tstrcmp strcmp
 # define tprintf printf
+# define tstrtoul strtoul
 #endif
 
 
@@ -19,20 +27,79 @@ Converts ISL translation files to BIN format
 ARGUMENTS:
   --input=<file>     Set path to a single ISL file
   --input-dir=<path> Set directory containing multiple ISL files
+  --recursive        Also search subdirectories of --input-dir
+  --include=<globs>  Comma-separated globs of ISL files to take from --input-dir
+  --exclude=<globs>  Comma-separated globs of files and folders to skip
+  --manifest=<file>  Build all targets listed in the manifest file
+  --jobs=<n>         Set number of worker threads for --manifest and --server
+  --server=<socket>  Serve compile, verify and decode requests on a Unix socket
+                     (Linux only)
   --output=<file>    Set path to the output BIN or ISL file
   --decode           Convert from BIN back to ISL
-  --verify           Check ISL file syntax and structure
+  --verify           Check ISL file syntax and structure, or BIN file checksums
+  --locales=<list>   Keep only these comma-separated locales, '*' and '?'
+                     match any characters (e.g. en_*,de_DE)
+  --hash             Print the content hash of a BIN file
+  --placeholders     Store precompiled placeholder segments (%1, {name})
+                     and check that all locales use the same placeholders
+  --utf16            Store values as aligned UTF-16LE for wide-string clients
+  --profile=<file>   Place the IDs listed in a usage profile at the front
+                     of the BIN file, hottest first
+  --namespaces       Group IDs by prefix (up to the first '_') and add an
+                     index, so readers can load one namespace at a time
+  --coverage         Report missing translations for every locale
+  --source-locale=<locale>
+                     Set reference locale for --coverage and --placeholders
+                     (default: en_US)
+  --json             Print the --coverage report as JSON
 
 EXAMPLE:
   islcompiler --input=source.isl
   islcompiler --input-dir=lang --output=out.bin
+  islcompiler --input-dir=lang --recursive --exclude=**/draft/**,*_old.isl
+  islcompiler --input-dir=lang --locales=en_*,de_DE --output=out.bin
+  islcompiler --manifest=build.manifest --jobs=8
+  islcompiler --input-dir=lang --coverage --json --output=coverage.json
 
 NOTES:
-  - --decode works only with --input
+  - --decode and --hash work only with --input
+  - Globs are matched against paths relative to --input-dir: '*' and '?' stay
+    within a folder, '**' spans folders, and a glob without '/' matches the
+    file name at any depth.
+  - Each usage profile line has the form: <id> [count]. IDs are ordered by
+    descending count, then by first appearance, lines starting with ';' are
+    comments. With --namespaces the profile order applies within each
+    namespace.
+  - --coverage exits with code 1 if any translation is missing. IDs that
+    the source locale lacks are reported, but do not change the exit code.
+  - --server reads one request line per connection and replies with OK or
+    ERROR followed by details, then closes the connection:
+      compile <output.bin> <input.isl> ...
+      verify <input.isl> ...
+      decode <input.bin> <output.isl>
+      shutdown
+    Use absolute paths, parsed files stay cached until they change.
+  - Each manifest line has the form: <output.bin> = <input.isl|dir> ...
+    Paths are relative to the manifest, lines starting with ';' are comments.
   - Overwrites the output file if it already exists.
 )";
 
 
+static std::vector<tstring> splitList(const tstring &list)
+{
+    std::vector<tstring> items;
+    size_t pos = 0;
+    while (pos < list.length()) {
+        size_t end = list.find(_T(','), pos);
+        if (end == tstring::npos)
+            end = list.length();
+        if (end > pos)
+            items.push_back(list.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return items;
+}
+
 #ifdef _WIN32
 int __cdecl _tmain (int argc, TCHAR *argv[])
 #else
@@ -41,15 +108,73 @@ int main(int argc, char *argv[])
 {
     std::locale::global(std::locale(""));
     NS_Args::parseCmdArgs(argc, argv);
-    if (argc < 2 || (!NS_Args::cmdArgContains(_T("--input")) && !NS_Args::cmdArgContains(_T("--input-dir")))) {
+    if (argc < 2 || (!NS_Args::cmdArgContains(_T("--input")) && !NS_Args::cmdArgContains(_T("--input-dir"))
+                        && !NS_Args::cmdArgContains(_T("--manifest")) && !NS_Args::cmdArgContains(_T("--server")))) {
         printf("%s", pHelp);
         return 0;
     }
 
-    printf("\nISL Translation Compiler (v1.1)\n");
+    // A JSON report on stdout has to stay parseable
+    if (!NS_Args::cmdArgContains(_T("--json")))
+        printf("\nISL Translation Compiler (v1.1)\n");
     if (NS_Args::cmdArgContains(_T("--log")))
         NS_Logger::AllowWriteLog();
 
+    ISLBinOptions binOptions;
+    binOptions.segments = NS_Args::cmdArgContains(_T("--placeholders"));
+    binOptions.utf16 = NS_Args::cmdArgContains(_T("--utf16"));
+    binOptions.namespaces = NS_Args::cmdArgContains(_T("--namespaces"));
+    if (NS_Args::cmdArgContains(_T("--source-locale")))
+        binOptions.sourceLocale = NS_Args::cmdArgValue(_T("--source-locale"));
+    if (NS_Args::cmdArgContains(_T("--locales")))
+        binOptions.locales = splitList(NS_Args::cmdArgValue(_T("--locales")));
+    if (NS_Args::cmdArgContains(_T("--profile"))) {
+        tstring err;
+        if (!NS_File::readProfile(NS_Args::cmdArgValue(_T("--profile")), binOptions.hotIds, err)) {
+            tprintf(_T("[ERROR] %s\n"), err.c_str());
+            return 1;
+        }
+    }
+
+    unsigned jobs = 0;
+    if (NS_Args::cmdArgContains(_T("--jobs")))
+        jobs = tstrtoul(NS_Args::cmdArgValue(_T("--jobs")).c_str(), nullptr, 10);
+
+#ifdef __linux__
+    if (NS_Args::cmdArgContains(_T("--server"))) {
+        tstring socketPath = NS_Args::cmdArgValue(_T("--server"));
+        tstring err;
+        ISLServer server;
+        server.setBinOptions(binOptions);
+        tprintf(_T("[OK] Listening on: %s\n"), socketPath.c_str());
+        fflush(stdout);
+        if (!server.run(socketPath, jobs, err)) {
+            tprintf(_T("[ERROR] %s\n"), err.c_str());
+            return 1;
+        }
+        return 0;
+    }
+#else
+    if (NS_Args::cmdArgContains(_T("--server"))) {
+        tprintf(_T("[ERROR] --server is only supported on Linux\n"));
+        return 1;
+    }
+#endif
+
+    if (NS_Args::cmdArgContains(_T("--manifest"))) {
+        tstring manifestPath = NS_Args::cmdArgValue(_T("--manifest"));
+        tstring err;
+        ISLManifest manifest;
+        manifest.setBinOptions(binOptions);
+        if (!manifest.load(manifestPath, err)) {
+            tprintf(_T("[ERROR] %s\n"), err.c_str());
+            return 1;
+        }
+        bool success = manifest.build(jobs, err);
+        tprintf(_T("%s"), err.c_str());
+        return success ? 0 : 1;
+    }
+
     tstring outPath;
     if (NS_Args::cmdArgContains(_T("--output")))
         outPath = NS_Args::cmdArgValue(_T("--output"));
@@ -58,7 +183,14 @@ int main(int argc, char *argv[])
     if (NS_Args::cmdArgContains(_T("--input-dir"))) {
         tstring inputDir = NS_Args::cmdArgValue(_T("--input-dir"));
 
-        inputFiles = NS_File::getFilesWithExtension(inputDir, _T(".isl"));
+        if (NS_Args::cmdArgContains(_T("--recursive")) || NS_Args::cmdArgContains(_T("--include"))
+                || NS_Args::cmdArgContains(_T("--exclude"))) {
+            inputFiles = NS_File::findFiles(inputDir, _T(".isl"), NS_Args::cmdArgContains(_T("--recursive")),
+                                            splitList(NS_Args::cmdArgValue(_T("--include"))),
+                                            splitList(NS_Args::cmdArgValue(_T("--exclude"))));
+        } else {
+            inputFiles = NS_File::getFilesWithExtension(inputDir, _T(".isl"));
+        }
         if (inputFiles.empty()) {
             tprintf(_T("[ERROR] Directory does not contain ISL files: %s\n"), inputDir.c_str());
             return 0;
@@ -72,6 +204,15 @@ int main(int argc, char *argv[])
             return 0;
         }
 
+        if (NS_Args::cmdArgContains(_T("--hash"))) {
+            ISLHeader header;
+            if (!NS_File::readBinHeader(inputPath, header) || header.version == ISL_VERSION_LEGACY)
+                tprintf(_T("[ERROR] File has no content hash: %s\n"), inputPath.c_str());
+            else
+                printf("%016llx\n", (unsigned long long)header.hash);
+            return 0;
+        }
+
         if (NS_Args::cmdArgContains(_T("--decode"))) {
             if (outPath.empty())
                 outPath = inputPath + _T(".isl");
@@ -87,10 +228,35 @@ int main(int argc, char *argv[])
 
     tstring err;
     ISLParser isl;
+    isl.setBinOptions(binOptions);
     if (NS_Args::cmdArgContains(_T("--verify"))) {
         isl.verify(inputFiles, err);
         tprintf(_T("%s\n"), err.c_str());
 
+    } else
+    if (NS_Args::cmdArgContains(_T("--coverage"))) {
+        TranslationsMap translMap;
+        for (const tstring &filePath : inputFiles) {
+            if (!isl.parseFile(filePath, err)) {
+                tprintf(_T("[ERROR] %s\n"), err.c_str());
+                return 1;
+            }
+            ISLParser::mergeTranslations(translMap, isl.translationsMap());
+        }
+        ISLCoverage coverage;
+        coverage.build(translMap, binOptions.sourceLocale);
+        tstring report = coverage.report(NS_Args::cmdArgContains(_T("--json")));
+        if (!outPath.empty()) {
+            std::string data = NS_Utils::TStrToUtf8(report);
+            if (!NS_File::writeFile(outPath, data)) {
+                tprintf(_T("[ERROR] Cannot write file: %s\n"), outPath.c_str());
+                return 1;
+            }
+        } else {
+            tprintf(_T("%s"), report.c_str());
+        }
+        return coverage.isComplete() ? 0 : 1;
+
     } else {
         if (outPath.empty()) {
             tstring path = NS_File::parentPath(inputFiles.at(0));
@@ -99,6 +265,10 @@ int main(int argc, char *argv[])
 #endif
             outPath = path + _T("/out.bin");
         }
+        // Large bundles are encoded in shards on this pool
+        ThreadPool pool(jobs);
+        binOptions.pool = &pool;
+        isl.setBinOptions(binOptions);
         if (!isl.translationToBin(inputFiles, outPath, err))
             tprintf(_T("[ERROR] Conversion failed: %s\n"), err.c_str());
         else {
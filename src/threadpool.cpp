@@ -0,0 +1,117 @@
+#include "threadpool.h"
+
+static thread_local ThreadPool *current_pool = nullptr;
+static thread_local unsigned current_worker = 0;
+
+
+ThreadPool::ThreadPool(unsigned threadCount) :
+    queued(0),
+    nextWorker(0),
+    pending(0),
+    stopping(false)
+{
+    if (threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+    for (unsigned i = 0; i < threadCount; i++)
+        workers.push_back(new Worker);
+    for (unsigned i = 0; i < threadCount; i++)
+        threads.emplace_back(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskCv.notify_all();
+    for (std::thread &thread : threads)
+        thread.join();
+    for (Worker *worker : workers)
+        delete worker;
+}
+
+void ThreadPool::submit(const std::function<void()> &task)
+{
+    // Tasks spawned by a worker stay on its own queue, others are spread round-robin
+    unsigned index = (current_pool == this) ? current_worker : nextWorker++ % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending++;
+    }
+    queued++;
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(task);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    taskCv.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCv.wait(lock, [this]() {
+        return pending == 0;
+    });
+}
+
+unsigned ThreadPool::size() const
+{
+    return workers.size();
+}
+
+bool ThreadPool::isWorkerThread() const
+{
+    return current_pool == this;
+}
+
+bool ThreadPool::popTask(unsigned index, std::function<void()> &task)
+{
+    {
+        Worker *own = workers[index];
+        std::lock_guard<std::mutex> lock(own->mutex);
+        if (!own->tasks.empty()) {
+            task = std::move(own->tasks.back());
+            own->tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+    for (unsigned i = 1; i < workers.size(); i++) {
+        Worker *victim = workers[(index + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (!victim->tasks.empty()) {
+            task = std::move(victim->tasks.front());
+            victim->tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(unsigned index)
+{
+    current_pool = this;
+    current_worker = index;
+    for (;;) {
+        std::function<void()> task;
+        if (popTask(index, task)) {
+            task();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0)
+                doneCv.notify_all();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        taskCv.wait(lock, [this]() {
+            return queued != 0 || stopping;
+        });
+        if (stopping && queued == 0)
+            break;
+    }
+}
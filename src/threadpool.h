@@ -0,0 +1,47 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    void submit(const std::function<void()> &task);
+    void wait();
+    unsigned size() const;
+    bool isWorkerThread() const;
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool popTask(unsigned index, std::function<void()> &task);
+    void run(unsigned index);
+
+    std::vector<Worker*>     workers;
+    std::vector<std::thread> threads;
+    std::mutex               mutex;
+    std::condition_variable  taskCv,
+                             doneCv;
+    std::atomic<unsigned>    queued,
+                             nextWorker;
+    unsigned                 pending;
+    bool                     stopping;
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,153 @@
+#include "utf16.h"
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(_M_X64)
+# include <emmintrin.h>
+# define UTF16_SSE2
+#endif
+
+#define ASCII_MASK_8   0x8080808080808080ULL
+#define ASCII_MASK_16  0xff80ff80ff80ff80ULL
+
+
+static void appendUnit(std::string &out, uint32_t unit)
+{
+    out.push_back((char)(unit & 0xff));
+    out.push_back((char)(unit >> 8));
+}
+
+bool utf8ToUtf16le(const char *data, size_t size, std::string &out)
+{
+    const unsigned char *p = (const unsigned char*)data, *end = p + size;
+    out.reserve(out.size() + size * 2);
+    while (p != end) {
+        // ASCII runs are widened in blocks
+#ifdef UTF16_SSE2
+        if (end - p >= 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+            if (_mm_movemask_epi8(chunk) == 0) {
+                char buf[32];
+                _mm_storeu_si128((__m128i*)buf, _mm_unpacklo_epi8(chunk, _mm_setzero_si128()));
+                _mm_storeu_si128((__m128i*)(buf + 16), _mm_unpackhi_epi8(chunk, _mm_setzero_si128()));
+                out.append(buf, sizeof(buf));
+                p += 16;
+                continue;
+            }
+        }
+#endif
+        if (end - p >= 8) {
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            if ((word & ASCII_MASK_8) == 0) {
+                char buf[16];
+                for (int i = 0; i < 8; i++) {
+                    buf[2 * i] = (char)p[i];
+                    buf[2 * i + 1] = 0;
+                }
+                out.append(buf, sizeof(buf));
+                p += 8;
+                continue;
+            }
+        }
+
+        uint32_t cp = *p++;
+        if (cp < 0x80) {
+            appendUnit(out, cp);
+            continue;
+        }
+        int extra;
+        uint32_t min;
+        if ((cp & 0xe0) == 0xc0) {
+            extra = 1; cp &= 0x1f; min = 0x80;
+        } else
+        if ((cp & 0xf0) == 0xe0) {
+            extra = 2; cp &= 0x0f; min = 0x800;
+        } else
+        if ((cp & 0xf8) == 0xf0) {
+            extra = 3; cp &= 0x07; min = 0x10000;
+        } else {
+            return false;
+        }
+        if (end - p < extra)
+            return false;
+        for (int i = 0; i < extra; i++) {
+            if ((p[i] & 0xc0) != 0x80)
+                return false;
+            cp = (cp << 6) | (p[i] & 0x3f);
+        }
+        p += extra;
+        if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+            return false;
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            appendUnit(out, 0xd800 | (cp >> 10));
+            appendUnit(out, 0xdc00 | (cp & 0x3ff));
+        } else {
+            appendUnit(out, cp);
+        }
+    }
+    return true;
+}
+
+bool utf16leToUtf8(const char *data, size_t units, std::string &out)
+{
+    const unsigned char *p = (const unsigned char*)data, *end = p + units * 2;
+    out.reserve(out.size() + units);
+    while (p != end) {
+#ifdef UTF16_SSE2
+        if (end - p >= 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(chunk, _mm_set1_epi16((short)0xff80)),
+                                                  _mm_setzero_si128())) == 0xffff) {
+                char buf[16];
+                _mm_storel_epi64((__m128i*)buf, _mm_packus_epi16(chunk, chunk));
+                out.append(buf, 8);
+                p += 16;
+                continue;
+            }
+        }
+#endif
+        if (end - p >= 8) {
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            if ((word & ASCII_MASK_16) == 0) {
+                out.push_back((char)p[0]);
+                out.push_back((char)p[2]);
+                out.push_back((char)p[4]);
+                out.push_back((char)p[6]);
+                p += 8;
+                continue;
+            }
+        }
+
+        uint32_t cp = p[0] | (p[1] << 8);
+        p += 2;
+        if (cp >= 0xd800 && cp <= 0xdfff) {
+            if (cp >= 0xdc00 || end - p < 2)
+                return false;
+            uint32_t low = p[0] | (p[1] << 8);
+            if (low < 0xdc00 || low > 0xdfff)
+                return false;
+            p += 2;
+            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+        }
+        if (cp < 0x80) {
+            out.push_back((char)cp);
+        } else
+        if (cp < 0x800) {
+            out.push_back((char)(0xc0 | (cp >> 6)));
+            out.push_back((char)(0x80 | (cp & 0x3f)));
+        } else
+        if (cp < 0x10000) {
+            out.push_back((char)(0xe0 | (cp >> 12)));
+            out.push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+            out.push_back((char)(0x80 | (cp & 0x3f)));
+        } else {
+            out.push_back((char)(0xf0 | (cp >> 18)));
+            out.push_back((char)(0x80 | ((cp >> 12) & 0x3f)));
+            out.push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+            out.push_back((char)(0x80 | (cp & 0x3f)));
+        }
+    }
+    return true;
+}
@@ -0,0 +1,11 @@
+#ifndef UTF16_H
+#define UTF16_H
+
+#include <cstddef>
+#include <string>
+
+// Both return false on malformed input, UTF-16 data is little-endian bytes
+bool utf8ToUtf16le(const char *data, size_t size, std::string &out);
+bool utf16leToUtf8(const char *data, size_t units, std::string &out);
+
+#endif // UTF16_H
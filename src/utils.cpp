@@ -1,5 +1,7 @@
 
 #include "utils.h"
+#include "islformat.h"
+#include "crc32c.h"
 #include <cstring>
 #include <sstream>
 #include <fstream>
@@ -17,24 +19,255 @@
 # include <sys/stat.h>
 # include <fcntl.h>
 # include <cstdint>
+# include <climits>
+# include <sys/uio.h>
+# include <unistd.h>
   typedef std::stringstream tstringstream;
   typedef std::ofstream tofstream;
-  typedef unsigned short WORD;
 #endif
 
-static const char ISL_MAGIC[] = "ISL";
 
+static bool writeChunks(const tstring &filePath, const std::vector<std::string> &chunks)
+{
+    // Written to a temporary file next to the target and renamed over it, so a failed
+    // write never leaves a truncated bundle behind
+#ifdef _WIN32
+    tstring tmpPath = filePath + L".tmp" + std::to_wstring(GetCurrentProcessId());
+    std::ofstream file(tmpPath, std::ios_base::out | std::ios::binary);
+    if (!file.is_open())
+        return false;
+    for (const std::string &chunk : chunks)
+        file.write(chunk.data(), chunk.size());
+    file.close();
+    if (file.fail() || !MoveFileEx(tmpPath.c_str(), filePath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFile(tmpPath.c_str());
+        return false;
+    }
+    return true;
+#else
+    // Scatter-gather write of all buffers, resumed after partial writes
+    tstring tmpPath = filePath + ".XXXXXX";
+    int fd = mkstemp(&tmpPath[0]);
+    if (fd < 0)
+        return false;
+    auto fail = [&]() {
+        close(fd);
+        unlink(tmpPath.c_str());
+        return false;
+    };
+    if (fchmod(fd, 0644) != 0)
+        return fail();
+    std::vector<iovec> iov;
+    iov.reserve(chunks.size());
+    for (const std::string &chunk : chunks) {
+        if (!chunk.empty())
+            iov.push_back(iovec{(void*)chunk.data(), chunk.size()});
+    }
+    size_t first = 0;
+    while (first < iov.size()) {
+        ssize_t n = writev(fd, &iov[first], (int)std::min<size_t>(iov.size() - first, IOV_MAX));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return fail();
+        while (first < iov.size() && (size_t)n >= iov[first].iov_len)
+            n -= iov[first++].iov_len;
+        if (first < iov.size()) {
+            iov[first].iov_base = (char*)iov[first].iov_base + n;
+            iov[first].iov_len -= n;
+        }
+    }
+    if (close(fd) != 0 || rename(tmpPath.c_str(), filePath.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+#endif
+}
+
+static bool sameContents(const tstring &filePath, const std::vector<std::string> &chunks)
+{
+    // The old bundle may be damaged behind an intact header, so its bytes are compared
+    std::ifstream file(filePath, std::ios_base::in | std::ios::binary);
+    if (!file.is_open())
+        return false;
+    std::vector<char> buf(1 << 16);
+    for (const std::string &chunk : chunks) {
+        for (size_t pos = 0; pos < chunk.size();) {
+            size_t n = std::min(chunk.size() - pos, buf.size());
+            file.read(buf.data(), n);
+            if ((size_t)file.gcount() != n || memcmp(buf.data(), chunk.data() + pos, n) != 0)
+                return false;
+            pos += n;
+        }
+    }
+    return file.peek() == std::char_traits<char>::eof();
+}
 
-static tstring Utf8ToTStr(const std::string &str)
+static bool matchesAny(const std::vector<tstring> &patterns, const tstring &relPath, bool isDir = false)
 {
+    // Patterns without a slash are matched against the file name at any depth, folders get
+    // a trailing slash so that "**/draft/**" prunes the folder itself
+    size_t sep = relPath.find_last_of(_T('/'));
+    const tchar *name = relPath.c_str() + (sep == tstring::npos ? 0 : sep + 1);
+    const tstring dirPath = isDir ? relPath + _T('/') : tstring();
+    for (const tstring &pattern : patterns) {
+        bool hasSlash = pattern.find(_T('/')) != tstring::npos;
+        const tstring &path = (hasSlash && isDir) ? dirPath : relPath;
+        if (NS_Utils::matchGlob(pattern.c_str(), hasSlash ? path.c_str() : name, path.c_str() + path.size()))
+            return true;
+    }
+    return false;
+}
+
+static void collectFiles(const tstring &root, const tstring &rel, const tstring &ext, bool recursive,
+                         const std::vector<tstring> &includes, const std::vector<tstring> &excludes, std::vector<tstring> &files)
+{
+    auto addFile = [&](const tstring &name, const tstring &path, const tstring &childRel) {
+        if (name.length() > ext.length() && name.compare(name.length() - ext.length(), ext.length(), ext) == 0
+                && (includes.empty() || matchesAny(includes, childRel)) && !matchesAny(excludes, childRel))
+            files.push_back(path);
+    };
 #ifdef _WIN32
-    std::wstring_convert<std::codecvt_utf8<wchar_t>> utf8_conv;
-    return utf8_conv.from_bytes(str);
+    tstring dirPath = rel.empty() ? root : root + L'\\' + rel;
+    std::replace(dirPath.begin(), dirPath.end(), L'/', L'\\');
+    WIN32_FIND_DATA fd;
+    HANDLE hFind = FindFirstFile((dirPath + L"\\*").c_str(), &fd);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return;
+    do {
+        tstring name = fd.cFileName;
+        if (name == L"." || name == L"..")
+            continue;
+        tstring childRel = rel.empty() ? name : rel + L'/' + name;
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (recursive && !matchesAny(excludes, childRel, true))
+                collectFiles(root, childRel, ext, recursive, includes, excludes, files);
+        } else {
+            addFile(name, dirPath + L'\\' + name, childRel);
+        }
+    } while (FindNextFile(hFind, &fd));
+    FindClose(hFind);
 #else
-    return str;
+    tstring dirPath = rel.empty() ? root : root + "/" + rel;
+    DIR *dir = opendir(dirPath.c_str());
+    if (!dir)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        tstring name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        tstring path = dirPath + "/" + name;
+        tstring childRel = rel.empty() ? name : rel + "/" + name;
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN || type == DT_LNK) {
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0)
+                continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR) {
+            if (recursive && !matchesAny(excludes, childRel, true))
+                collectFiles(root, childRel, ext, recursive, includes, excludes, files);
+        } else
+        if (type == DT_REG) {
+            addFile(name, path, childRel);
+        }
+    }
+    closedir(dir);
 #endif
 }
 
+namespace NS_Utils
+{
+    tstring Utf8ToTStr(const std::string &str)
+    {
+#ifdef _WIN32
+        std::wstring_convert<std::codecvt_utf8<wchar_t>> utf8_conv;
+        return utf8_conv.from_bytes(str);
+#else
+        return str;
+#endif
+    }
+
+    std::string TStrToUtf8(const tstring &str)
+    {
+#ifdef _WIN32
+        std::wstring_convert<std::codecvt_utf8<wchar_t>> utf8_conv;
+        return utf8_conv.to_bytes(str);
+#else
+        return str;
+#endif
+    }
+
+    bool SplitLine(const tstring &line, std::vector<tstring> &tokens)
+    {
+        auto isSeparator = [](tchar c) {
+            return c == _T(' ') || c == _T('\t') || c == _T('\r');
+        };
+        size_t pos = 0, len = line.length();
+        while (pos < len) {
+            if (isSeparator(line[pos])) {
+                pos++;
+                continue;
+            }
+            if (line[pos] == _T('"')) {
+                size_t end = line.find(_T('"'), pos + 1);
+                if (end == tstring::npos)
+                    return false;
+                tokens.push_back(line.substr(pos + 1, end - pos - 1));
+                pos = end + 1;
+            } else {
+                size_t end = pos;
+                while (end < len && !isSeparator(line[end]))
+                    end++;
+                tokens.push_back(line.substr(pos, end - pos));
+                pos = end;
+            }
+        }
+        return true;
+    }
+
+    bool matchGlob(const tchar *p, const tchar *s, const tchar *end)
+    {
+        while (*p) {
+            if (p[0] == _T('*') && p[1] == _T('*')) {
+                p += 2;
+                bool dirs = (*p == _T('/'));
+                if (dirs)
+                    p++;
+                for (const tchar *it = s;; it++) {
+                    // "**/" matches zero or more whole directories, a bare "**" anything
+                    if ((!dirs || it == s || it[-1] == _T('/')) && matchGlob(p, it, end))
+                        return true;
+                    if (it == end)
+                        return false;
+                }
+            }
+            if (*p == _T('*')) {
+                p++;
+                for (const tchar *it = s;; it++) {
+                    if (matchGlob(p, it, end))
+                        return true;
+                    if (it == end || *it == _T('/'))
+                        return false;
+                }
+            }
+            if (*p == _T('?')) {
+                if (s == end || *s == _T('/'))
+                    return false;
+            } else
+            if (s == end || *p != *s) {
+                return false;
+            }
+            p++;
+            s++;
+        }
+        return s == end;
+    }
+}
+
 namespace NS_Args
 {
     std::vector<tstring> cmd_args;
@@ -111,186 +344,103 @@ namespace NS_File
         return true;
     }
 
-    bool readBinFile(const tstring &filePath, std::unordered_map<tstring, LocaleMap> &translMap)
+    bool readBinData(const tstring &filePath, std::string &data)
     {
-        std::ifstream file(filePath, std::ios_base::out | std::ios::binary);
+        std::ifstream file(filePath, std::ios_base::in | std::ios::binary);
         if (!file.is_open()) {
             NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
             return false;
         }
-
-        char magic[sizeof(ISL_MAGIC)] = { 0 };
-        file.read(magic, sizeof(magic));
-        if (file.fail() || strncmp(magic, ISL_MAGIC, sizeof(magic) - 1) != 0) {
+        std::stringstream stream;
+        stream << file.rdbuf();
+        if (file.fail() || stream.fail()) {
             NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
             file.close();
             return false;
         }
+        file.close();
+        data = stream.str();
+        return true;
+    }
 
-        WORD mapSize = 0;
-        file.read((char*)&mapSize, sizeof(mapSize));
-        if (file.fail()) {
+    bool readBinFile(const tstring &filePath, std::unordered_map<tstring, LocaleMap> &translMap, SegmentsMap *segmentsMap,
+                     ISLVariants *variants)
+    {
+        std::string data;
+        if (!readBinData(filePath, data))
+            return false;
+        if (!NS_Format::deserialize(data.data(), data.size(), translMap, segmentsMap, variants)) {
             NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-            file.close();
             return false;
         }
-
-        for (WORD i = 0; i < mapSize; i++) {
-            uint8_t len = 0;
-            file.read((char*)&len, sizeof(len));
-            if (file.fail()) {
-                NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                file.close();
-                return false;
-            }
-
-            std::string key;
-            key.resize(len);
-            file.read(&key[0], len);
-            if (file.fail()) {
-                NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                file.close();
-                return false;
-            }
-
-            WORD localeSize = 0;
-            file.read((char*)&localeSize, sizeof(localeSize));
-            if (file.fail()) {
-                NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                file.close();
-                return false;
-            }
-
-            LocaleMap localeMap;
-            for (WORD j = 0; j < localeSize; j++) {
-                uint8_t len = 0;
-                file.read((char*)&len, sizeof(len));
-                if (file.fail()) {
-                    NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                    file.close();
-                    return false;
-                }
-
-                std::string str;
-                str.resize(len);
-                file.read(&str[0], len);
-                if (file.fail()) {
-                    NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                    file.close();
-                    return false;
-                }
-
-                WORD len2 = 0;
-                file.read((char*)&len2, sizeof(len2));
-                if (file.fail()) {
-                    NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                    file.close();
-                    return false;
-                }
-
-                std::string str2;
-                str2.resize(len2);
-                file.read(&str2[0], len2);
-                if (file.fail()) {
-                    NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                    file.close();
-                    return false;
-                }
-                localeMap[Utf8ToTStr(str)] = Utf8ToTStr(str2);
-            }
-            translMap[Utf8ToTStr(key)] = localeMap;
-        }
-        file.close();
         return true;
     }
 
-    bool writeBinFile(const tstring &filePath, const std::unordered_map<tstring, LocaleMap> &translMap)
+    bool readBinHeader(const tstring &filePath, ISLHeader &header)
     {
-        std::ofstream file(filePath, std::ios_base::out | std::ios::binary);
+        std::ifstream file(filePath, std::ios_base::in | std::ios::binary);
         if (!file.is_open()) {
             NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
             return false;
         }
-        file.write(ISL_MAGIC, sizeof(ISL_MAGIC));
-        if (file.fail()) {
+        char buf[ISL_HEADER_SIZE] = { 0 };
+        file.read(buf, sizeof(buf));
+        size_t size = file.gcount();
+        file.close();
+        if (!NS_Format::readHeader(buf, size, header)) {
             NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-            file.close();
             return false;
         }
-        WORD mapSize = translMap.size();
-        file.write((char*)&mapSize, sizeof(mapSize));
-        if (file.fail()) {
-            NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-            file.close();
+        return true;
+    }
+
+    bool verifyBinFile(const tstring &filePath, tstring &error)
+    {
+        std::ifstream file(filePath, std::ios_base::in | std::ios::binary);
+        if (!file.is_open()) {
+            error = _T("cannot read file");
             return false;
         }
-#ifdef _WIN32
-        std::wstring_convert<std::codecvt_utf8<wchar_t>> utf8_conv;
-#endif
-        for (auto it = translMap.cbegin(); it != translMap.cend(); ++it) {
-#ifdef _WIN32
-            std::string key = utf8_conv.to_bytes(it->first);
-#else
-            std::string key = it->first;
-#endif
-            uint8_t len = key.length();
-            file.write((char*)&len, sizeof(len));
-            if (file.fail()) {
-                NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                file.close();
-                return false;
-            }
-            file.write((char*)key.c_str(), key.length());
-            if (file.fail()) {
-                NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                file.close();
-                return false;
-            }
-
-            const LocaleMap &localeMap = it->second;
-            WORD localeSize = localeMap.size();
-            file.write((char*)&localeSize, sizeof(localeSize));
-            if (file.fail()) {
-                NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                file.close();
-                return false;
+        // Sections are read in order, so the stream only seeks for the namespace index
+        size_t filePos = 0;
+        auto read = [&file, &filePos](size_t offset, char *buf, size_t length) -> size_t {
+            if (offset != filePos) {
+                file.clear();
+                if (!file.seekg(offset))
+                    return 0;
             }
-            for (auto it = localeMap.cbegin(); it != localeMap.cend(); ++it) {
-#ifdef _WIN32
-                std::string str[2] = {utf8_conv.to_bytes(it->first), utf8_conv.to_bytes(it->second)};
-#else
-                std::string str[2] = {it->first, it->second};
-#endif
-                uint8_t len = str[0].length();
-                file.write((char*)&len, sizeof(len));
-                if (file.fail()) {
-                    NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                    file.close();
-                    return false;
-                }
-                file.write((char*)str[0].c_str(), str[0].length());
-                if (file.fail()) {
-                    NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                    file.close();
-                    return false;
-                }
+            file.read(buf, length);
+            size_t n = (size_t)file.gcount();
+            filePos = offset + n;
+            return n;
+        };
+        return NS_Format::verify(fileSize(filePath), read, error);
+    }
 
-                WORD len2 = str[1].length();
-                file.write((char*)&len2, sizeof(len2));
-                if (file.fail()) {
-                    NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                    file.close();
-                    return false;
-                }
-                file.write((char*)str[1].c_str(), str[1].length());
-                if (file.fail()) {
-                    NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
-                    file.close();
-                    return false;
-                }
-            }
+    bool writeBinFile(const tstring &filePath, const std::unordered_map<tstring, LocaleMap> &translMap,
+                      const ISLBinOptions &options, const MessagesMap *messages)
+    {
+        std::vector<std::string> chunks;
+        if (!NS_Format::serialize(translMap, chunks, options, messages)) {
+            NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
+            return false;
+        }
+        size_t size = 0;
+        for (const std::string &chunk : chunks)
+            size += chunk.size();
+
+        // Leave an identical bundle untouched, so its timestamp stays valid for build caches
+        ISLHeader header, oldHeader;
+        NS_Format::readHeader(chunks[0].data(), chunks[0].size(), header);
+        if (fileExists(filePath) && fileSize(filePath) == size && readBinHeader(filePath, oldHeader)
+                && oldHeader.version == header.version && oldHeader.flags == header.flags && oldHeader.hash == header.hash
+                && sameContents(filePath, chunks))
+            return true;
+
+        if (!writeChunks(filePath, chunks)) {
+            NS_Logger::WriteLog(DEFAULT_ERROR_MESSAGE);
+            return false;
         }
-        file.close();
         return true;
     }
 
@@ -307,6 +457,21 @@ namespace NS_File
 #endif
     }
 
+    size_t fileSize(const tstring &filePath)
+    {
+#ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA fad;
+        if (!::GetFileAttributesEx(filePath.c_str(), GetFileExInfoStandard, &fad))
+            return 0;
+        return (size_t)(((uint64_t)fad.nFileSizeHigh << 32) | fad.nFileSizeLow);
+#else
+        struct stat st;
+        if (stat(filePath.c_str(), &st) != 0)
+            return 0;
+        return st.st_size;
+#endif
+    }
+
     std::vector<tstring> getFilesWithExtension(const tstring &folderPath, const tstring &ext)
     {
         std::vector<tstring> files;
@@ -349,6 +514,81 @@ namespace NS_File
         return files;
     }
 
+    std::vector<tstring> findFiles(const tstring &folderPath, const tstring &ext, bool recursive,
+                                   const std::vector<tstring> &includes, const std::vector<tstring> &excludes)
+    {
+        std::vector<tstring> files;
+        if (folderPath.empty())
+            return files;
+        tstring root(folderPath);
+        while (root.length() > 1 && (root.back() == _T('/')
+#ifdef _WIN32
+                                     || root.back() == L'\\'
+#endif
+                                     ))
+            root.pop_back();
+        collectFiles(root, tstring(), ext, recursive, includes, excludes, files);
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    bool readProfile(const tstring &filePath, std::vector<tstring> &hotIds, tstring &error)
+    {
+        // One "<id> [count]" per line: IDs sort by descending count, then by first appearance
+        std::string data;
+        if (!readFile(filePath, data)) {
+            error = _T("cannot read file ") + filePath;
+            return false;
+        }
+        tstring text = NS_Utils::Utf8ToTStr(data);
+        std::vector<std::pair<tstring, unsigned long long>> entries;
+        std::unordered_map<tstring, size_t> index;
+        size_t lineNum = 0, pos = 0;
+        while (pos < text.length()) {
+            size_t end = text.find(_T('\n'), pos);
+            if (end == tstring::npos)
+                end = text.length();
+            tstring line = text.substr(pos, end - pos);
+            pos = end + 1;
+            lineNum++;
+
+            std::vector<tstring> tokens;
+            if (!NS_Utils::SplitLine(line, tokens) || tokens.size() > 2) {
+                error = filePath + _T(": expected '<id> [count]' in line ") + to_tstring(lineNum);
+                return false;
+            }
+            if (tokens.empty() || tokens[0][0] == _T(';'))
+                continue;
+            unsigned long long count = 0;
+            if (tokens.size() == 2) {
+                size_t digits = 0;
+                while (digits < tokens[1].length() && tokens[1][digits] >= _T('0') && tokens[1][digits] <= _T('9'))
+                    count = count * 10 + (tokens[1][digits++] - _T('0'));
+                if (digits == 0 || digits != tokens[1].length()) {
+                    error = filePath + _T(": invalid count in line ") + to_tstring(lineNum);
+                    return false;
+                }
+            }
+            auto it = index.find(tokens[0]);
+            if (it == index.end()) {
+                index[tokens[0]] = entries.size();
+                entries.push_back(std::make_pair(tokens[0], count));
+            } else {
+                entries[it->second].second += count;
+            }
+        }
+
+        std::stable_sort(entries.begin(), entries.end(), [](const std::pair<tstring, unsigned long long> &a,
+                                                            const std::pair<tstring, unsigned long long> &b) {
+            return a.second > b.second;
+        });
+        hotIds.clear();
+        hotIds.reserve(entries.size());
+        for (const auto &entry : entries)
+            hotIds.push_back(entry.first);
+        return true;
+    }
+
 #ifdef _WIN32
     tstring fromNativeSeparators(const tstring &path)
     {
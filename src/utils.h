@@ -3,6 +3,7 @@
 #define UTILS_H
 
 #include "islparser.h"
+#include "islformat.h"
 #ifdef _WIN32
 # define to_tstring std::to_wstring
 #else
@@ -13,6 +14,14 @@
 #define DEFAULT_ERROR_MESSAGE tstring(_T("An error occurred: ")) + FUNCTION_INFO
 #define ADVANCED_ERROR_MESSAGE DEFAULT_ERROR_MESSAGE + _T(" ") + NS_Utils::GetLastErrorAsString()
 
+namespace NS_Utils
+{
+tstring Utf8ToTStr(const std::string &str);
+std::string TStrToUtf8(const tstring &str);
+bool SplitLine(const tstring &line, std::vector<tstring> &tokens);
+bool matchGlob(const tchar *p, const tchar *s, const tchar *end);
+}
+
 namespace NS_Args
 {
 void parseCmdArgs(int argc, tchar *argv[]);
@@ -27,10 +36,20 @@ void setAppPath(const tstring &path);
 #endif
 bool readFile(const tstring &filePath, std::string &str);
 bool writeFile(const tstring &filePath, std::string &str);
-bool readBinFile(const tstring &filePath, std::unordered_map<tstring, LocaleMap> &translMap);
-bool writeBinFile(const tstring &filePath, const std::unordered_map<tstring, LocaleMap> &translMap);
+bool readBinData(const tstring &filePath, std::string &data);
+bool readBinFile(const tstring &filePath, std::unordered_map<tstring, LocaleMap> &translMap, SegmentsMap *segmentsMap = nullptr,
+                 ISLVariants *variants = nullptr);
+bool readBinHeader(const tstring &filePath, ISLHeader &header);
+bool verifyBinFile(const tstring &filePath, tstring &error);
+bool writeBinFile(const tstring &filePath, const std::unordered_map<tstring, LocaleMap> &translMap,
+                  const ISLBinOptions &options = ISLBinOptions(), const MessagesMap *messages = nullptr);
 bool fileExists(const tstring &filePath);
+size_t fileSize(const tstring &filePath);
 std::vector<tstring> getFilesWithExtension(const tstring &folderPath, const tstring &ext);
+std::vector<tstring> findFiles(const tstring &folderPath, const tstring &ext, bool recursive,
+                               const std::vector<tstring> &includes, const std::vector<tstring> &excludes);
+bool readFiles(const std::vector<tstring> &filePaths, std::vector<std::string> &contents, std::vector<bool> &loaded);
+bool readProfile(const tstring &filePath, std::vector<tstring> &hotIds, tstring &error);
 #ifdef _WIN32
 tstring fromNativeSeparators(const tstring &path);
 tstring toNativeSeparators(const tstring &path);